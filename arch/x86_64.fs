@@ -5,7 +5,8 @@
 \ construct and execute raw machine code directly from Forth.
 \
 \ This is NOT a traditional assembler.
-\ There is no text parsing, no labels, and no instruction selection.
+\ There is no text parsing and no instruction selection. Labels are plain
+\ numbers, resolved by END-CODE (see %label at the end of this file).
 \ Instead, instructions are encoded explicitly as data.
 \
 \ Each instruction is built using two stack cells:
@@ -13,23 +14,31 @@
 \   - a payload cell: raw u64 data (immediate or displacement)
 \
 \ The base cell stores:
-\   [ byte_count | instruction_bytes... ]
-\   - upper 8 bits  : number of instruction bytes
-\   - lower 56 bits : packed opcode / prefixes / ModR/M / SIB
+\   [ payload_count | byte_count | instruction_bytes... ]
+\   - bits 60-63 : number of payload bytes that follow the instruction
+\   - bits 56-59 : number of instruction bytes
+\   - bits 0-55  : packed opcode / prefixes / ModR/M / SIB
 \
 \ The payload cell stores:
-\   - a raw 64-bit value (imm64, disp32, etc.)
+\   - a raw 64-bit value (imm64, disp32, etc.), of which only the low
+\     payload_count bytes are emitted
 \
 \ Instruction bytes are assembled using |instr and related helpers.
-\ Payload data is packed explicitly using |imm64.
+\ Payload data is packed explicitly using |imm64 or |payload.
 \
 \ Execution model:
 \   asm:   begins instruction construction (compile-time)
 \   ;asm   copies bytes + payload into executable memory and executes them
 \
-\ Instructions are copied into an executable byte buffer and invoked
-\ directly via a function pointer. There is no intermediate representation
-\ and no hidden transformation stage.
+\ Instructions are copied into an executable byte buffer, followed by a ret,
+\ and invoked directly via a function pointer. There is no intermediate
+\ representation and no hidden transformation stage.
+\
+\ Between CODE name and END-CODE, ;asm appends each instruction to a buffer
+\ instead of running it, and END-CODE installs the whole sequence as the
+\ native word name. Inside it rbx holds the top of the data stack, r12 the
+\ stack base and r13 the depth (the top itself is not in memory). rax, rcx,
+\ rdx, rsi, rdi and r8-r11 are free to use.
 \
 \ You can freely mix Forth control flow with instruction construction,
 \ enabling dynamic code generation, JIT-style execution, and metaprogramming.
@@ -76,14 +85,11 @@
 ;
 
 : _base-len@ ( base -- len )
-    DEC 56 rshift HEX
+    DEC 56 rshift HEX F and
 ;
 
 : _base-len+1 ( base -- base' )
-    dup _base-len@ 1 +
-    >R
-    HEX 00FFFFFFFFFFFFFF and 
-    R> DEC 56 lshift | HEX
+    DEC 1 56 lshift + HEX
 ;
 
 : _base-bytes@ ( base -- bytes )
@@ -92,7 +98,7 @@
 
 : _base-pack-byte ( base byte -- base ' )
     over _base-len@ 8 * lshift \ byte << (len * 8)
-    >R dup _base-bytes@ R> |
+    |
 ;
 
 : |instr ( base payload byte -- base' payload )
@@ -102,15 +108,15 @@
     swap 
 ;
 
-: |imm64 ( base payload u64 -- base payload' )
-    dup DEC  0 rshift HEX FF and |
-    dup DEC  8 rshift HEX FF and |
-    dup DEC 16 rshift HEX FF and |
-    dup DEC 24 rshift HEX FF and |
-    dup DEC 32 rshift HEX FF and |
-    dup DEC 40 rshift HEX FF and |
-    dup DEC 48 rshift HEX FF and |
-        DEC 56 rshift HEX FF and |
+: |payload ( base payload u64 n -- base' payload' )
+    \ the low n bytes of u64 follow the instruction bytes
+    >R nip swap
+    R> DEC 60 lshift HEX |
+    swap
+;
+
+: |imm64 ( base payload u64 -- base' payload' )
+    8 |payload
 ;
 
 HEX
@@ -329,39 +335,101 @@ HEX
 
 \ full instructions
 
-: %lea-rr ( reg reg  -- )
-    asm:
-        2over
-        _add-rex-2op 
-        >R >R \ save registers
-        _lea _MOD-RR
-        R> R> \ release registers
-        reg-low swap reg-low 
-        |instr |instr
-    ;asm
+\ register to register
+
+: _rex-rr ( reg rm -- byte )
+    \ REX.W, with REX.R for reg and REX.B for rm when they are r8-r15
+    reg-ext? 3 rshift
+    swap reg-ext? 1 rshift |
+    48 |
+;
+
+: _modrm-rr ( reg rm -- byte )
+    \ mod 11, both operands registers
+    reg-low swap reg-low 3 lshift |
+    C0 |
+;
+
+: _op-rr ( dst src op -- )
+    \ op r/m64, r64 with r/m = dst
+    >R
+    2over swap _rex-rr
+    rot swap _modrm-rr
+    R> swap
+    >R >R >R
+    asm: R> |instr R> |instr R> |instr ;asm
 ;
 
-: %lea-rm ( reg mem -- )
+: _op-r ( reg op ext -- )
+    \ op r/m64 with the opcode extension ext in the reg field
+    -rot 2over _rex-rr
+    rot _modrm-rr
+    >R swap >R >R
+    asm: R> |instr R> |instr R> |instr ;asm
+;
+
+\ The operands of one instruction can be packed in a cell:
+\ bits 0-7 ModR/M reg, 8-15 the VEX source register (vvvv), 16-23 ModR/M rm.
+
+: _pack3 ( reg vvvv rm -- ops )
+    10 lshift swap 8 lshift | |
+;
+
+: _op.reg ( ops -- reg ) FF and ;
+: _op.v ( ops -- vvvv ) 8 rshift FF and ;
+: _op.rm ( ops -- rm ) 10 rshift FF and ;
+
+: _ops.modrm ( ops -- modrm )
+    dup _op.reg swap _op.rm _modrm-rr
+;
+
+: _ops.sib? ( ops -- flag )
+    \ [rsp] and [r12] need a SIB byte
+    _op.rm 7 and 4 =
+;
+
+: _op-m ( reg base disp op -- )
+    \ op r64, [base + disp32]
+    >R >R
+    0 swap _pack3
+    dup _op.reg over _op.rm _rex-rr swap
+    R> R> rot
+    swap dup _ops.modrm 40 -
+    swap _ops.sib? -rot
+    >R >R >R >R >R
     asm:
-        over
-        _add-rex-1op
-        >R
-        _lea _MOD-RM
-        R>
-        swap reg-low
-        |instr |instr
+        R> |instr R> |instr R> |instr
+        R> IF 24 |instr THEN
+        R> 4 |payload
     ;asm
 ;
 
+: %mov-rr ( dst src -- ) 89 _op-rr ;
+: %add-rr ( dst src -- ) 01 _op-rr ;
+: %sub-rr ( dst src -- ) 29 _op-rr ;
+: %xor-rr ( dst src -- ) 31 _op-rr ;
+: %cmp-rr ( dst src -- ) 39 _op-rr ; \ flags of dst - src
+: %test-rr ( dst src -- ) 85 _op-rr ; \ flags of dst and src
+
+: %inc ( reg -- ) FF 0 _op-r ;
+: %dec ( reg -- ) FF 1 _op-r ;
+
+\ memory and immediates
+
+: %mov-rm ( reg base disp -- ) 8B _op-m ; \ reg = [base + disp]
+: %mov-mr ( base disp reg -- ) rot 89 _op-m ; \ [base + disp] = reg
+: %lea-rm ( reg base disp -- ) 8D _op-m ; \ reg = base + disp
+
+: %lea-rr ( reg reg -- ) \ lea reg, [reg]
+    0 %lea-rm
+;
+
 : %mov-imm64 ( imm64 reg -- )
-    asm:
-        _add-rex-1op
-        reg-low 
-        >R >R
-        _mov-imm64
-        R> R>
-       swap |imm64
-    ;asm
+    dup reg-ext? 3 rshift 48 |
+    swap reg-low B8 +
+    -rot
+    >R >R >R
+    asm: R> |instr R> |instr R> |imm64 ;asm
 ;
 
 : %set-stack ( reg -- )
@@ -380,5 +448,315 @@ HEX
     _rsp swap %mov-imm64
 ;
 
+\ labels and jumps (only inside CODE ... END-CODE)
+\
+\ A label is any number, bound to the current position with %label. Jumps
+\ may refer to labels defined before or after them: each one is emitted with
+\ a zero displacement and CODE-FIXUP records it, END-CODE patches them all
+\ (and fails if a label is missing). The ...8 forms take a rel8 and must be
+\ within -128..127 bytes of their label, the others take a rel32.
+
+: %label ( label -- )
+    CODE-LABEL
+;
+
+: %jmp ( label -- )
+    >R
+    asm: E9 |instr 0 4 |payload ;asm
+    R> 4 CODE-FIXUP
+;
+
+: %jmp8 ( label -- )
+    >R
+    asm: EB |instr 0 1 |payload ;asm
+    R> 1 CODE-FIXUP
+;
+
+: _jcc ( label cc -- )
+    swap >R >R
+    asm: 0F |instr R> 80 + |instr 0 4 |payload ;asm
+    R> 4 CODE-FIXUP
+;
+
+: _jcc8 ( label cc -- )
+    swap >R >R
+    asm: R> 70 + |instr 0 1 |payload ;asm
+    R> 1 CODE-FIXUP
+;
+
+\ condition codes, after %cmp-rr: signed l/g, unsigned b/a
+: %jb ( label -- ) 2 _jcc ;
+: %jae ( label -- ) 3 _jcc ;
+: %je ( label -- ) 4 _jcc ;
+: %jne ( label -- ) 5 _jcc ;
+: %jbe ( label -- ) 6 _jcc ;
+: %ja ( label -- ) 7 _jcc ;
+: %js ( label -- ) 8 _jcc ;
+: %jns ( label -- ) 9 _jcc ;
+: %jl ( label -- ) C _jcc ;
+: %jge ( label -- ) D _jcc ;
+: %jle ( label -- ) E _jcc ;
+: %jg ( label -- ) F _jcc ;
+: %jz ( label -- ) %je ;
+: %jnz ( label -- ) %jne ;
+
+: %jb8 ( label -- ) 2 _jcc8 ;
+: %jae8 ( label -- ) 3 _jcc8 ;
+: %je8 ( label -- ) 4 _jcc8 ;
+: %jne8 ( label -- ) 5 _jcc8 ;
+: %jbe8 ( label -- ) 6 _jcc8 ;
+: %ja8 ( label -- ) 7 _jcc8 ;
+: %js8 ( label -- ) 8 _jcc8 ;
+: %jns8 ( label -- ) 9 _jcc8 ;
+: %jl8 ( label -- ) C _jcc8 ;
+: %jge8 ( label -- ) D _jcc8 ;
+: %jle8 ( label -- ) E _jcc8 ;
+: %jg8 ( label -- ) F _jcc8 ;
+: %jz8 ( label -- ) %je8 ;
+: %jnz8 ( label -- ) %jne8 ;
+
+\ vector registers
+\ ymm registers are the xmm numbers with 10 added, so reg-low and reg-ext?
+\ work on both and the encoders take the vector length from the operands.
+
+: %xmm0 0 ;   : %xmm1 1 ;   : %xmm2 2 ;   : %xmm3 3 ;
+: %xmm4 4 ;   : %xmm5 5 ;   : %xmm6 6 ;   : %xmm7 7 ;
+: %xmm8 8 ;   : %xmm9 9 ;   : %xmm10 A ;  : %xmm11 B ;
+: %xmm12 C ;  : %xmm13 D ;  : %xmm14 E ;  : %xmm15 F ;
+
+: %ymm0 10 ;  : %ymm1 11 ;  : %ymm2 12 ;  : %ymm3 13 ;
+: %ymm4 14 ;  : %ymm5 15 ;  : %ymm6 16 ;  : %ymm7 17 ;
+: %ymm8 18 ;  : %ymm9 19 ;  : %ymm10 1A ; : %ymm11 1B ;
+: %ymm12 1C ; : %ymm13 1D ; : %ymm14 1E ; : %ymm15 1F ;
+
+\ CPU features (CPU-FEATURES bits), so code can pick a path at runtime
+
+: _cpu-bit ( n -- flag )
+    CPU-FEATURES swap rshift 1 and
+;
+
+: sse2? ( -- flag ) 0 _cpu-bit ;
+: ssse3? ( -- flag ) 1 _cpu-bit ;
+: sse4.1? ( -- flag ) 2 _cpu-bit ;
+: sse4.2? ( -- flag ) 3 _cpu-bit ;
+: popcnt? ( -- flag ) 4 _cpu-bit ;
+: avx? ( -- flag ) 5 _cpu-bit ;
+: avx2? ( -- flag ) 6 _cpu-bit ;
+: bmi2? ( -- flag ) 7 _cpu-bit ;
+: avx512f? ( -- flag ) 8 _cpu-bit ;
+
+\ opcode specs
+\ An SSE/AVX opcode is named by its mandatory prefix, its opcode map and the
+\ opcode byte (Intel's 66.0F38 00 is 00 _66.0F38). The spec packs them in
+\ one cell: bits 0-7 opcode, 8-11 map (1 = 0F, 2 = 0F38, 3 = 0F3A),
+\ 12-15 prefix (0 none, 1 = 66, 2 = F3, 3 = F2), bit 16 VEX.W.
+
+: _66.0F ( op -- spec ) 1100 | ;
+: _66.0F38 ( op -- spec ) 1200 | ;
+: _66.0F3A ( op -- spec ) 1300 | ;
+: _F3.0F ( op -- spec ) 2100 | ;
+: .W1 ( spec -- spec' ) 10000 | ;
+
+: _spec.map ( spec -- map ) 8 rshift F and ;
+: _spec.pp ( spec -- pp ) C rshift F and ;
+: _spec.w ( spec -- w ) 10 rshift 1 and ;
+
+
+: _ops.L ( ops -- L )
+    \ 256 bit when any operand is a ymm register
+    dup _op.reg over _op.v | swap _op.rm |
+    10 and 4 rshift
+;
+
+\ VEX (3 byte form): C4 [~R ~X ~B map] [W ~vvvv L pp] opcode ModR/M
+
+: _vex-b1 ( ops spec -- b1 )
+    _spec.map swap
+    dup _op.reg 8 and 4 lshift
+    swap _op.rm 8 and 2 lshift |
+    E0 swap - |
+;
+
+: _vex-b2 ( ops spec -- b2 )
+    dup _spec.w 7 lshift swap _spec.pp |
+    over _op.v F and F swap - 3 lshift |
+    swap _ops.L 2 lshift |
+;
+
+: _vex-head ( ops spec -- b1 b2 op )
+    2over _vex-b1 rot
+    2over _vex-b2 rot
+    nip FF and
+;
+
+: _vex-rr ( ops spec -- )
+    \ register form
+    over _ops.modrm >R
+    _vex-head >R >R >R
+    asm: C4 |instr R> |instr R> |instr R> |instr R> |instr ;asm
+;
+
+: _vex-rr-ib ( ops spec imm8 -- )
+    >R
+    over _ops.modrm >R
+    _vex-head >R >R >R
+    asm:
+        C4 |instr R> |instr R> |instr R> |instr R> |instr
+        R> 1 |payload
+    ;asm
+;
+
+: _vex-m ( ops spec disp32 -- )
+    \ memory form, [rm + disp32]
+    >R
+    over _ops.sib? >R
+    over _ops.modrm 40 - >R
+    _vex-head >R >R >R
+    asm:
+        C4 |instr R> |instr R> |instr R> |instr R> |instr
+        R> IF 24 |instr THEN
+        R> 4 |payload
+    ;asm
+;
+
+: _vex3 ( dst a b spec -- )
+    >R _pack3 R> _vex-rr
+;
+
+: _vex2 ( dst src spec -- )
+    >R 0 swap _pack3 R> _vex-rr
+;
+
+\ AVX/AVX2 (VEX encoded). Operands: dst a b is dst = a op b, with xmm
+\ registers for 128 bit and ymm for 256 bit. Memory operands are [reg + disp].
+\ Use %vzeroupper before running SSE code or returning to C after ymm code.
+
+: %vpaddb ( dst a b -- ) FC _66.0F _vex3 ;
+: %vpaddd ( dst a b -- ) FE _66.0F _vex3 ;
+: %vpaddq ( dst a b -- ) D4 _66.0F _vex3 ;
+: %vpsubb ( dst a b -- ) F8 _66.0F _vex3 ;
+: %vpsubq ( dst a b -- ) FB _66.0F _vex3 ;
+: %vpand ( dst a b -- ) DB _66.0F _vex3 ;
+: %vpandn ( dst a b -- ) DF _66.0F _vex3 ;
+: %vpor ( dst a b -- ) EB _66.0F _vex3 ;
+: %vpxor ( dst a b -- ) EF _66.0F _vex3 ;
+: %vpcmpeqb ( dst a b -- ) 74 _66.0F _vex3 ;
+: %vpcmpeqd ( dst a b -- ) 76 _66.0F _vex3 ;
+: %vpcmpeqq ( dst a b -- ) 29 _66.0F38 _vex3 ;
+: %vpminub ( dst a b -- ) DA _66.0F _vex3 ;
+: %vpmaxub ( dst a b -- ) DE _66.0F _vex3 ;
+: %vpsadbw ( dst a b -- ) F6 _66.0F _vex3 ;
+: %vpshufb ( dst a b -- ) 00 _66.0F38 _vex3 ;
+
+: %vpmovmskb ( reg vec -- ) D7 _66.0F _vex2 ; \ reg = byte sign mask
+: %vptest ( a b -- ) 17 _66.0F38 _vex2 ; \ ZF = (a and b) == 0
+: %vpbroadcastb ( vec xmm -- ) 78 _66.0F38 _vex2 ;
+: %vpbroadcastq ( vec xmm -- ) 59 _66.0F38 _vex2 ;
+: %vmovq-xr ( xmm reg -- ) 6E _66.0F .W1 _vex2 ;
+: %vmovq-rx ( reg xmm -- ) swap 7E _66.0F .W1 _vex2 ;
+
+: %vpshufd ( dst src imm8 -- )
+    >R 0 swap _pack3 70 _66.0F R> _vex-rr-ib
+;
+
+: %vpermq ( dst src imm8 -- )
+    >R 0 swap _pack3 00 _66.0F3A .W1 R> _vex-rr-ib
+;
+
+: %vpalignr ( dst a b imm8 -- )
+    >R _pack3 0F _66.0F3A R> _vex-rr-ib
+;
+
+: %vperm2i128 ( dst a b imm8 -- )
+    >R _pack3 46 _66.0F3A R> _vex-rr-ib
+;
+
+: %vmovdqu-rm ( vec reg disp -- ) \ load
+    >R 0 swap _pack3 6F _F3.0F R> _vex-m
+;
+
+: %vmovdqu-mr ( reg disp vec -- ) \ store
+    rot >R 0 swap _pack3 7F _F3.0F R> _vex-m
+;
+
+: %vmovdqa-rm ( vec reg disp -- ) \ load, 16/32 byte aligned
+    >R 0 swap _pack3 6F _66.0F R> _vex-m
+;
+
+: %vmovdqa-mr ( reg disp vec -- ) \ store, 16/32 byte aligned
+    rot >R 0 swap _pack3 7F _66.0F R> _vex-m
+;
+
+: %vzeroupper ( -- )
+    asm: C5 |instr F8 |instr 77 |instr ;asm
+;
+
+\ SSE2 (legacy encoding, xmm only): prefix, REX, 0F [38|3A], opcode, ModR/M.
+\ The REX byte is always emitted (40 when no bit is needed), it never has W.
+
+: _sse-prefix ( pp -- byte )
+    dup 1 = IF drop 66 ELSE 2 = IF F3 ELSE F2 THEN THEN
+;
+
+: _sse-rex ( ops -- rex )
+    dup _op.reg 8 and 1 rshift
+    swap _op.rm 8 and 3 rshift |
+    40 |
+;
+
+: _sse-head ( ops spec -- prefix rex map op )
+    dup _spec.pp _sse-prefix rot
+    over _sse-rex rot
+    nip dup _spec.map swap FF and
+;
+
+: _sse-map ( base payload map -- base' payload' )
+    >R 0F |instr R>
+    dup 2 = IF drop 38 |instr ELSE 3 = IF 3A |instr THEN THEN
+;
+
+: _sse-rr ( ops spec -- )
+    over _ops.modrm >R
+    _sse-head >R >R >R >R
+    asm: R> |instr R> |instr R> _sse-map R> |instr R> |instr ;asm
+;
+
+: _sse-m ( ops spec disp32 -- )
+    \ memory form, [rm + disp32]
+    >R
+    over _ops.sib? >R
+    over _ops.modrm 40 - >R
+    _sse-head >R >R >R >R
+    asm:
+        R> |instr R> |instr R> _sse-map R> |instr R> |instr
+        R> IF 24 |instr THEN
+        R> 4 |payload
+    ;asm
+;
+
+: _sse2 ( dst src spec -- )
+    >R 0 swap _pack3 R> _sse-rr
+;
+
+: %paddb ( dst src -- ) FC _66.0F _sse2 ;
+: %paddq ( dst src -- ) D4 _66.0F _sse2 ;
+: %psubb ( dst src -- ) F8 _66.0F _sse2 ;
+: %pand ( dst src -- ) DB _66.0F _sse2 ;
+: %por ( dst src -- ) EB _66.0F _sse2 ;
+: %pxor ( dst src -- ) EF _66.0F _sse2 ;
+: %pcmpeqb ( dst src -- ) 74 _66.0F _sse2 ;
+: %pminub ( dst src -- ) DA _66.0F _sse2 ;
+: %psadbw ( dst src -- ) F6 _66.0F _sse2 ;
+: %pshufb ( dst src -- ) 00 _66.0F38 _sse2 ; \ SSSE3
+: %pmovmskb ( reg xmm -- ) D7 _66.0F _sse2 ;
+
+: %movdqu-rm ( xmm reg disp -- ) \ load
+    >R 0 swap _pack3 6F _F3.0F R> _sse-m
+;
+
+: %movdqu-mr ( reg disp xmm -- ) \ store
+    rot >R 0 swap _pack3 7F _F3.0F R> _sse-m
+;
+
 DEC
 
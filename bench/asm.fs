@@ -0,0 +1,18 @@
+\ asm.fs -- build and run a machine code snippet through the ICL
+\ Each op encodes xor rax, rax ; ret with asm: / |instr and runs it with
+\ EXEC-CODE via ;asm.
+\ ops: 20000
+
+INCLUDE arch/x86_64.fs
+
+HEX
+: clear-rax ( -- )
+    asm: 48 |instr 31 |instr C0 |instr C3 |instr ;asm
+;
+DEC
+
+: snippets ( n -- )
+    0 DO clear-rax LOOP
+;
+
+20000 snippets
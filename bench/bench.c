@@ -0,0 +1,349 @@
+// bench.c -- benchmark driver for skforth
+//
+// usage: bench [-n runs] [-b skforth] file.fs...
+//
+// Every benchmark file is fed to a fresh skforth process on stdin, `runs`
+// times. The driver reports the median wall clock time, the time per op and
+// the peak resident set size as JSON on stdout. The time of a run that only
+// says `bye` (config, init and bootstrap.fs) is measured the same way and
+// subtracted before dividing by the op count.
+//
+// Header comments in a benchmark file:
+//   \ ops: N      number of ops one run performs (default 1)
+//   \ repeat: N   repeat the lines after `\ body` N times, replacing every
+//                 `#` in them with the repetition number
+//   \ include     write the repeated body to a file and INCLUDE it instead
+//                 of feeding it on stdin
+//   \ body        end of the setup part
+//
+// skforth runs with HOME set to build/bench-home so the benchmarks get their
+// own config.fs and BLOCKS.blk. The output of each run goes to
+// build/bench-home/out.txt; a run that prints [ERROR] or "Unknown word" fails
+// the benchmark.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned long long u64;
+
+#define MAX_RUNS 101
+
+#define BENCH_HOME "build/bench-home"
+
+// Larger than the defaults so the generated INCLUDE file and the string
+// churn fit without GROW.
+static const char *bench_config = "1024        ( BLOCK_SIZE ) \n"
+                                  "64          ( NUM_BLOCKS ) \n"
+                                  "1024        ( STACK_SIZE ) \n"
+                                  "20000       ( MAX_WORDS ) \n"
+                                  "1024 1024 * ( MAX_CODE_SPACE ) \n"
+                                  "256         ( CF_STACK ) \n"
+                                  "1024 64 *   ( DATA_SIZE ) \n"
+                                  "1024 1024 * 16 * ( MAX_BLOB_SPACE ) \n";
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t cap;
+} TEXT;
+
+typedef struct {
+  char name[64];
+  u64 ops;
+  u64 repeat;
+  int include;
+  TEXT setup;
+  TEXT body;
+} BENCH;
+
+static char home[2048];
+static char out_path[4096];
+
+static void die(const char *fmt, const char *arg) {
+  fprintf(stderr, "bench: ");
+  fprintf(stderr, fmt, arg);
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+static void text_append(TEXT *t, const char *s, size_t n) {
+  if (t->len + n + 1 > t->cap) {
+    t->cap = (t->len + n + 1) * 2;
+    t->buf = realloc(t->buf, t->cap);
+    if (!t->buf)
+      die("%s", strerror(errno));
+  }
+  memcpy(t->buf + t->len, s, n);
+  t->len += n;
+  t->buf[t->len] = '\0';
+}
+
+static void text_puts(TEXT *t, const char *s) { text_append(t, s, strlen(s)); }
+
+// Appends `body` with every '#' replaced by `n`.
+static void text_append_numbered(TEXT *t, const TEXT *body, u64 n) {
+  char num[32];
+  int num_len = snprintf(num, sizeof(num), "%llu", n);
+  const char *p = body->buf;
+  const char *end = body->buf + body->len;
+  while (p < end) {
+    const char *hash = memchr(p, '#', end - p);
+    if (!hash) {
+      text_append(t, p, end - p);
+      break;
+    }
+    text_append(t, p, hash - p);
+    text_append(t, num, num_len);
+    p = hash + 1;
+  }
+}
+
+static void write_file(const char *path, const char *s, size_t n) {
+  FILE *f = fopen(path, "w");
+  if (!f || fwrite(s, 1, n, f) != n)
+    die("could not write %s", path);
+  fclose(f);
+}
+
+static void setup_home(void) {
+  char cwd[1024];
+  char path[4096];
+  if (!getcwd(cwd, sizeof(cwd)))
+    die("%s", strerror(errno));
+  snprintf(home, sizeof(home), "%s/" BENCH_HOME, cwd);
+  snprintf(out_path, sizeof(out_path), "%s/out.txt", home);
+
+  const char *dirs[] = {"", "/.config", "/.config/skforth"};
+  for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+    snprintf(path, sizeof(path), "%s%s", home, dirs[i]);
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+      die("could not create %s", path);
+  }
+  snprintf(path, sizeof(path), "%s/.config/skforth/config.fs", home);
+  write_file(path, bench_config, strlen(bench_config));
+}
+
+static void parse_bench(const char *path, BENCH *b) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    die("could not open %s", path);
+
+  memset(b, 0, sizeof(*b));
+  b->ops = 1;
+  b->repeat = 1;
+
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  snprintf(b->name, sizeof(b->name), "%s", base);
+  char *dot = strrchr(b->name, '.');
+  if (dot)
+    *dot = '\0';
+
+  char line[1024];
+  int in_body = 0;
+  while (fgets(line, sizeof(line), f)) {
+    if (!strncmp(line, "\\ ops:", 6)) {
+      b->ops = strtoull(line + 6, NULL, 10);
+    } else if (!strncmp(line, "\\ repeat:", 9)) {
+      b->repeat = strtoull(line + 9, NULL, 10);
+    } else if (!strncmp(line, "\\ include", 9)) {
+      b->include = 1;
+    } else if (!strncmp(line, "\\ body", 6)) {
+      in_body = 1;
+    } else {
+      text_puts(in_body ? &b->body : &b->setup, line);
+    }
+  }
+  fclose(f);
+
+  if (b->ops == 0)
+    die("%s: ops must be at least 1", path);
+}
+
+// Builds the text fed to skforth on stdin.
+static void build_input(const BENCH *b, TEXT *in) {
+  TEXT body = {0};
+  for (u64 i = 0; i < b->repeat && b->body.len; i++)
+    text_append_numbered(&body, &b->body, i);
+
+  if (b->setup.len)
+    text_append(in, b->setup.buf, b->setup.len);
+  if (b->include) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.include.fs", home, b->name);
+    write_file(path, body.buf ? body.buf : "", body.len);
+    text_puts(in, "\nINCLUDE ");
+    text_puts(in, path);
+    text_puts(in, "\n");
+  } else if (body.len) {
+    text_append(in, body.buf, body.len);
+  }
+  text_puts(in, "\nbye\n");
+  free(body.buf);
+}
+
+static u64 now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+// Returns 0 when the run exited normally without printing an error.
+static int run_once(const char *binary, const TEXT *in, u64 *ns,
+                    long *rss_kb) {
+  int fds[2];
+  if (pipe(fds) == -1)
+    die("%s", strerror(errno));
+
+  u64 start = now_ns();
+  pid_t pid = fork();
+  if (pid == -1)
+    die("%s", strerror(errno));
+  if (pid == 0) {
+    int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1)
+      _exit(127);
+    dup2(fds[0], STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    dup2(out, STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    close(out);
+    setenv("HOME", home, 1);
+    execl(binary, binary, (char *)NULL);
+    _exit(127);
+  }
+  close(fds[0]);
+
+  size_t off = 0;
+  while (off < in->len) {
+    ssize_t n = write(fds[1], in->buf + off, in->len - off);
+    if (n <= 0)
+      break; // skforth exited early, the status check below reports it
+    off += n;
+  }
+  close(fds[1]);
+
+  int status;
+  struct rusage ru;
+  if (wait4(pid, &status, 0, &ru) == -1)
+    die("%s", strerror(errno));
+  *ns = now_ns() - start;
+  *rss_kb = ru.ru_maxrss;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return -1;
+
+  FILE *f = fopen(out_path, "r");
+  if (!f)
+    return -1;
+  char line[4096];
+  int failed = 0;
+  while (!failed && fgets(line, sizeof(line), f))
+    failed = strstr(line, "[ERROR]") || strstr(line, "Unknown word");
+  fclose(f);
+  return failed ? -1 : 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  u64 x = *(const u64 *)a;
+  u64 y = *(const u64 *)b;
+  return (x > y) - (x < y);
+}
+
+// Runs `in` `runs` times; returns the median time and the largest peak RSS.
+static int measure(const char *binary, const TEXT *in, int runs, u64 *median,
+                   long *rss_kb) {
+  u64 times[MAX_RUNS];
+  *median = 0;
+  *rss_kb = 0;
+  for (int i = 0; i < runs; i++) {
+    long rss;
+    if (run_once(binary, in, &times[i], &rss) != 0)
+      return -1;
+    if (rss > *rss_kb)
+      *rss_kb = rss;
+  }
+  qsort(times, runs, sizeof(times[0]), cmp_u64);
+  *median = times[runs / 2];
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *binary = "./build/skforth";
+  int runs = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = atoi(optarg);
+      break;
+    case 'b':
+      binary = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n runs] [-b skforth] file.fs...\n",
+              argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (runs < 1 || runs > MAX_RUNS)
+    die("runs must be between 1 and %s", "101");
+  if (optind == argc)
+    die("%s", "no benchmark files given");
+
+  signal(SIGPIPE, SIG_IGN);
+  setup_home();
+
+  TEXT empty = {0};
+  text_puts(&empty, "bye\n");
+  u64 startup;
+  long startup_rss;
+  if (measure(binary, &empty, runs, &startup, &startup_rss) != 0)
+    die("%s failed to start", binary);
+
+  printf("{\n");
+  printf("  \"binary\": \"%s\",\n", binary);
+  printf("  \"runs\": %d,\n", runs);
+  printf("  \"startup_ns\": %llu,\n", startup);
+  printf("  \"startup_rss_kb\": %ld,\n", startup_rss);
+  printf("  \"benchmarks\": [");
+
+  int failures = 0;
+  for (int i = optind; i < argc; i++) {
+    BENCH b;
+    TEXT in = {0};
+    parse_bench(argv[i], &b);
+    build_input(&b, &in);
+
+    u64 median;
+    long rss_kb;
+    int ok = measure(binary, &in, runs, &median, &rss_kb) == 0;
+    if (!ok) {
+      fprintf(stderr, "bench: %s failed, see %s\n", b.name, out_path);
+      failures++;
+    }
+
+    u64 net = median > startup ? median - startup : 0;
+    printf("%s\n    {\"name\": \"%s\", \"ok\": %s, \"ops\": %llu, "
+           "\"median_ns\": %llu, \"ns_per_op\": %.1f, \"peak_rss_kb\": %ld}",
+           i == optind ? "" : ",", b.name, ok ? "true" : "false", b.ops,
+           median, (double)net / (double)b.ops, rss_kb);
+
+    free(in.buf);
+    free(b.setup.buf);
+    free(b.body.buf);
+  }
+  printf("\n  ]\n}\n");
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
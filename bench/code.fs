@@ -0,0 +1,17 @@
+\ code.fs -- call a native word built with CODE / END-CODE
+\ The word is inc rbx (increment the top of the stack) assembled once.
+\ ops: 1000000
+
+INCLUDE arch/x86_64.fs
+
+HEX
+: %inc-rbx ( -- ) asm: 48 |instr FF |instr C3 |instr ;asm ;
+DEC
+
+CODE inc-top %inc-rbx END-CODE
+
+: bump ( n -- )
+    0 swap 0 DO inc-top LOOP drop
+;
+
+1000000 bump
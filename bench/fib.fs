@@ -0,0 +1,9 @@
+\ fib.fs -- doubly recursive Fibonacci
+\ One op is one call of fib: fib(30) makes 2 * fib(31) - 1 calls.
+\ ops: 2692537
+
+: fib ( n -- fib[n] )
+    dup 2 < IF ELSE dup 1- fib swap 2 - fib + THEN
+;
+
+30 fib drop
@@ -0,0 +1,9 @@
+\ include.fs -- INCLUDE a generated file of 10000 colon definitions
+\ The body below is written out 10000 times (with # replaced by the
+\ repetition number) to a temporary file which is then INCLUDEd.
+\ One op is one definition.
+\ ops: 10000
+\ repeat: 10000
+\ include
+\ body
+: def# # 1 + dup * ;
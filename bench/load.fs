@@ -0,0 +1,11 @@
+\ load.fs -- LOAD the same short source block 5000 times
+\ One op is one LOAD. The block runs code in interpret mode, so it is parsed
+\ every time instead of coming from the compiled-block cache.
+\ ops: 5000
+\ repeat: 5000
+
+1 BLOCK BLOCK-SIZE 32 FILL
+s" 1 2 + drop 3 4 * drop 5 dup + drop" 1 BLOCK swap COPY-BYTES
+
+\ body
+1 LOAD
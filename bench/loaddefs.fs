@@ -0,0 +1,13 @@
+\ loaddefs.fs -- LOAD a block of colon definitions 1000 times
+\ One op is one LOAD of the same twelve definitions.
+\ ops: 1000
+\ repeat: 1000
+
+2 BLOCK BLOCK-SIZE 32 FILL
+s" : sq dup * ; : cube dup sq * ; : quad sq sq ; : avg + 2 / ;" 2 BLOCK swap COPY-BYTES
+s" : w0 0 BEGIN dup 10 < WHILE 1 + REPEAT ; : w1 w0 sq ; : w2 w1 cube ;" 2 BLOCK 128 + swap COPY-BYTES
+s" : w3 IF 1 ELSE 2 THEN ; : w4 w3 w2 + ; : w5 5 0 DO I + LOOP ;" 2 BLOCK 256 + swap COPY-BYTES
+s" : w6 w5 w4 avg ; : w7 w6 quad ;" 2 BLOCK 384 + swap COPY-BYTES
+
+\ body
+2 LOAD
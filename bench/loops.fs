@@ -0,0 +1,12 @@
+\ loops.fs -- two nested BEGIN/WHILE countdown loops
+\ One op is one trip through the inner loop.
+\ ops: 4000000
+
+: nest ( -- )
+    2000 BEGIN dup WHILE
+        2000 BEGIN dup WHILE 1- REPEAT drop
+        1-
+    REPEAT drop
+;
+
+nest
@@ -0,0 +1,34 @@
+\ sieve.fs -- odd-only sieve of Eratosthenes over 8192 cells, run 100 times
+\ One op is one full sieve (1899 primes below 16384).
+\ ops: 100
+
+INCLUDE std.fs
+
+8192 buff: flags
+
+: flag ( i -- addr )
+    CELLS flags buf-data +
+;
+
+: sieve ( -- count )
+    flags buf-data 8192 CELLS 1 FILL
+    0
+    8192 0 DO
+        I flag @ IF
+            I 2 * 3 +           \ prime
+            dup I +             \ first odd multiple
+            BEGIN dup 8192 < WHILE
+                0 over flag !
+                over +
+            REPEAT
+            2drop
+            1 +
+        THEN
+    LOOP
+;
+
+: sieves ( n -- )
+    0 DO sieve drop LOOP
+;
+
+100 sieves
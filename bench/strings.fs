@@ -0,0 +1,7 @@
+\ strings.fs -- s" churn: 20000 interpreted string literals
+\ One op is one s" parsed, copied into the transient ring and dropped.
+\ ops: 20000
+\ repeat: 20000
+
+\ body
+s" the quick brown fox jumps over the lazy dog" 2drop
@@ -77,13 +77,7 @@
     BLOB-LEN @ + BLOB-LEN !
 ;
 
-: s" PARSE-STRING ( string -- addr len )
-    dup >R 
-    BLOB-HERE dup >R 
-    swap dup BLOB-ALLOC
-    COPY-BYTES
-    R> R>
-; IMMEDIATE
+\ s" is a primitive, interpreted strings are transient
 
 \ word to do shell commands
 
@@ -106,19 +100,8 @@
 ; IMMEDIATE
 
 \ words to work with BLOCKS
-
-: BLOCK ( n -- addr ) 
-    BLOCK-SIZE *
-    BLOCKS-BASE +
-;
-
-: LOAD ( n -- )
-    dup BLK!
-    BLOCK
-    BLOCK-SIZE
-    INTERPRET-BLOCK
-    0 BLK!
-;
+\ BLOCK, BUFFER, LOAD, UPDATE, SAVE-BUFFERS, EMPTY-BUFFERS and FLUSH are
+\ primitives
 
 : LIST ( n -- )
    BLOCK
@@ -127,15 +110,10 @@
 ;
 
 : LISTALL ( -- )
-    0 
-    BEGIN
-    dup #BLOCKS 1- <> 
-    WHILE
-       dup ." BLOCK " . ." -------" cr
-       dup >R LIST cr
-       R> 1 +
-    REPEAT
-    drop
+    #BLOCKS 1- 0 ?DO
+       ." BLOCK " I . ." -------" cr
+       I LIST cr
+    LOOP
 ;
 
 : NVIM ( n -- )
@@ -143,36 +121,16 @@
     dup EDITOR-BLOCK !
     BLOCK BLOCK-SIZE LOAD-EXTRN-EDITBUFF
     SYS" nvim -c 'e!' ~/.config/skforth/block_editor.fs"
+    EDITOR-BLOCK @ SAVE-EXTRN-EDITBUFF \ back into the block buffer
 ;
 
 : EDIT ( n -- ) \ ALIAS to NVIM until an editor is made
     NVIM 
 ;
 
-: UPDATE ( -- )
-    EDITOR-BLOCK @ -1 = 
-    IF
-        ." no BLOCK in editor" cr
-    ELSE
-        1 EDITOR-DIRTY !
-        ." Editor BLOCK marked as dirty." cr
-    THEN
-;
-
-: FLUSH ( -- )
-    EDITOR-DIRTY @ 
-    IF
-        EDITOR-BLOCK @ SAVE-EXTRN-EDITBUFF
-        0  EDITOR-DIRTY !
-        ." EDITBUFF saved to marked BLOCK." cr 
-    ELSE
-        ." EDITBUFF is not set to dirty."   cr
-    THEN
-;
-
 : ERASE ( n -- )
     dup
-    BLOCK BLOCK-SIZE 0 FILL
+    BLOCK BLOCK-SIZE 0 FILL UPDATE
     ." BLOCK " . ." erased" cr
 ;
 
@@ -1,8 +1,12 @@
 #define _GNU_SOURCE
 #include <asm-generic/errno-base.h>
 #include <ctype.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,7 +14,13 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 // blocks sintax
 // BLOCK    ( u -- addr )
@@ -21,6 +31,33 @@
 
 #define SOURCEINFO 0
 
+// DIRECT_THREADED selects the inner interpreter:
+//   1 -> computed-goto dispatch loop with inlined core primitives (default)
+//   0 -> classic execute() calling every word through its code pointer
+// build the classic one with `make skforth-classic` to compare both engines
+#ifndef DIRECT_THREADED
+#define DIRECT_THREADED 1
+#endif
+
+// PEEPHOLE enables the optimizer ; runs over every new definition
+// (constant folding, superinstructions and tail calls)
+#ifndef PEEPHOLE
+#define PEEPHOLE 1
+#endif
+
+// STACK_CHECKS keeps the depth checks in spush/spop and the core stack
+// primitives. The stacks sit between PROT_NONE guard pages either way, so
+// with 0 (`make skforth-unchecked`) running off a stack faults and is
+// reported by stack_fault() instead of the per-operation checks
+#ifndef STACK_CHECKS
+#define STACK_CHECKS 1
+#endif
+#if STACK_CHECKS
+#define CHECKED(cond) (cond)
+#else
+#define CHECKED(cond) (0 && (cond))
+#endif
+
 #if defined(SOURCEINFO) && SOURCEINFO == 1
 #define print_source_line(void)                                                \
   { printf("[SOURCELINE] %d\n[FUNC]%s\n", __LINE__, __func__); }
@@ -40,6 +77,7 @@ u64 MAX_CODE_SPACE;
 u64 CF_STACK;
 u64 DATA_SIZE;
 u64 MAX_BYTES_SPACE;
+u64 NUM_BUFFERS = 8; // optional, last value in config.fs
 
 #define CONFIG_STACK_SIZE 200
 #define CONFIG_DIC_SIZE 2
@@ -54,9 +92,67 @@ u64 MAX_BYTES_SPACE;
 typedef enum mode { INTERPRET = 1, COMPILE = 0 } MODE;
 
 #define IMMEDIATE 0x01
+// compiled to machine code by the native backend (see native_compile)
+#define NATIVE 0x02
+// assembled with CODE ... END-CODE, ->code is machine code in code space
+#define MACHINE 0x04
+// translated to C by COMPILE-C, ->code lives in a dlopen()ed object
+#define COMPILED_C 0x08
 
 typedef struct word WORD;
 
+// opcodes the threaded inner interpreter runs inline. Every other word is
+// OP_CALL and goes through its code pointer/continuation as usual
+typedef enum opcode {
+  OP_CALL = 0,
+  OP_DOCOL,
+  OP_LIT,
+  OP_ZBRANCH,
+  OP_BRANCH,
+  OP_EXIT,
+  OP_PUSHVAL,
+  OP_PUSHPTR,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DEC,
+  OP_DUP,
+  OP_DROP,
+  OP_SWAP,
+  OP_OVER,
+  OP_ROT,
+  OP_EQZ,
+  OP_EQ,
+  OP_LT,
+  OP_GT,
+  OP_FETCH,
+  OP_STORE,
+  OP_TOR,
+  OP_FROMR,
+  // superinstructions emitted by the peephole optimizer
+  OP_LITADD,
+  OP_DUPFETCH,
+  OP_OVERADD,
+  OP_ZEQBRANCH,
+  OP_TAIL,
+  // counted loops
+  OP_DO,
+  OP_QDO,
+  OP_LOOP,
+  OP_PLUSLOOP,
+  OP_LEAVE,
+  OP_I,
+  OP_COUNT
+} OPCODE;
+
+// inline cell that follows a word inside a compiled definition
+typedef enum operand {
+  OPERAND_NONE = 0,
+  OPERAND_VALUE, // raw value (LIT n)
+  OPERAND_CODE,  // address in code space (branch target)
+  OPERAND_WORD,  // WORD * ((TAIL) name)
+} OPERAND;
+
 typedef struct word {
   const char *name;
 
@@ -66,8 +162,30 @@ typedef struct word {
   // list of words u64 flags;
   u64 flags;
   u64 *data;
+  u64 op; // OPCODE used by the threaded inner interpreter
+  WORD **refs; // COMPILED_C: the words its C code refers to, NULL ended
 } WORD;
 
+OPERAND word_operand(WORD *w) {
+  switch (w->op) {
+  case OP_LIT:
+  case OP_LITADD:
+    return OPERAND_VALUE;
+  case OP_ZBRANCH:
+  case OP_BRANCH:
+  case OP_ZEQBRANCH:
+  case OP_QDO:
+  case OP_LOOP:
+  case OP_PLUSLOOP:
+  case OP_LEAVE:
+    return OPERAND_CODE;
+  case OP_TAIL:
+    return OPERAND_WORD;
+  default:
+    return OPERAND_NONE;
+  }
+}
+
 //  main stack
 u64 *stack = NULL;
 u64 sp = 0;
@@ -76,6 +194,33 @@ u64 sp = 0;
 WORD *dictionary = NULL;
 u64 here = 0;
 
+// open-addressing hash index over dictionary names. Each slot stores a
+// dictionary index + 1 (0 is an empty slot); redefining a name overwrites its
+// slot so the newest definition wins, just like the old backwards scan
+u64 *dict_index = NULL;
+u64 dict_index_size = 0;
+u64 dict_fence = 0; // FORGET leaves the words below this alone
+
+// internal words resolved once after init() so the compile helpers don't have
+// to look them up by name every time they emit code
+WORD *word_lit = NULL;
+WORD *word_zbranch = NULL;
+WORD *word_branch = NULL;
+WORD *word_parse_name = NULL;
+WORD *word_type = NULL;
+WORD *word_shell_cmd = NULL;
+WORD *word_lit_add = NULL;
+WORD *word_dup_fetch = NULL;
+WORD *word_over_add = NULL;
+WORD *word_zeq_branch = NULL;
+WORD *word_tail = NULL;
+WORD *word_exit = NULL;
+WORD *word_do = NULL;
+WORD *word_qdo = NULL;
+WORD *word_loop = NULL;
+WORD *word_plus_loop = NULL;
+WORD *word_leave = NULL;
+
 // memory for word definitions
 WORD *current_def = NULL;
 WORD *last_created = NULL;
@@ -111,14 +256,39 @@ u64 dp = 0;
 // u64 *blocks_base = NULL;
 u_int8_t *blocks_base = NULL;
 
+// BLOCKS.blk is mapped at the start of a larger PROT_NONE reservation, so
+// MORE-BLOCKS can grow it without moving BLOCKS-BASE
+#define BLOCK_RESERVE (1ull << 32)
+int block_fd = -1;
+u64 block_reserve = 0; // bytes reserved at blocks_base
+
 int tmp_block_editor_fd;
 u64 curr_block_num = -1;
-u64 editor_dirty = 0;
+
+// State of a LOAD whose result may go into the block cache
+typedef struct block_recording {
+  struct block_recording *outer; // enclosing LOAD being recorded
+  u64 first;                     // dictionary index before the LOAD
+  int tainted;                   // did something that cannot be replayed
+  WORD **refs;                   // words resolved but not defined by it
+  u64 nrefs;
+  u64 refs_cap;
+} BLOCK_RECORDING;
+
+BLOCK_RECORDING *block_recording = NULL;
+void block_recording_note(WORD *w);
+void block_cache_drop(u64 blk);
+void block_index_stale(void);
+void save_buffers_at_exit(void);
+extern unsigned char *code_buf; // CODE ... END-CODE assembly buffer
+extern u64 code_buf_len;
 
 u64 num_base = 10;
 
 // instruction pointer
 u64 *ip = NULL;
+// last word the inner interpreter called, for stack fault reports
+WORD *running_word = NULL;
 MODE f_mode = INTERPRET;
 
 char *current_line_buffer = NULL;
@@ -127,6 +297,11 @@ u64 input_index = 0;
 #define CELLSIZE sizeof(u64)
 
 void execute(WORD *w);
+void init(void);
+u64 primitive_op(void (*code)(WORD *));
+void loop_enter(u64 limit, u64 index);
+int loop_step(u64 n);
+void heap_stats(void);
 
 void allstats(WORD *w) {
   UNUSED(w);
@@ -141,10 +316,11 @@ void allstats(WORD *w) {
          "<no info>", ((u64)STACK_SIZE * CELLSIZE), rsp * CELLSIZE,
          (u64)STACK_SIZE, rsp, ((u64)CF_STACK * CELLSIZE), cfsp * CELLSIZE,
          (u64)CF_STACK, (u64)cfsp, MAX_BYTES_SPACE, bytes_p);
+  heap_stats();
 }
 
 int spush(u64 v) {
-  if (sp == STACK_SIZE) {
+  if (CHECKED(sp == STACK_SIZE)) {
     printf("%s[ERROR] Stack is full\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return 0;
@@ -153,7 +329,7 @@ int spush(u64 v) {
   return -1;
 }
 u64 spop(void) {
-  if (sp == 0) {
+  if (CHECKED(sp == 0)) {
     printf("%s[ERROR] Stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return 0xDEADBEEF;
@@ -204,6 +380,12 @@ void memcpy_bytes(WORD *w) {
   }
 }
 WORD *find_word(const char *name, u64 len);
+void dict_index_insert(WORD *w);
+void dict_mark_take(void);
+void dict_log_write(u64 slot);
+void dict_marks_init(void);
+void emit_code(u64 v);
+int ensure_code(u64 cells);
 
 void lit(WORD *w) {
   UNUSED(w);
@@ -226,10 +408,9 @@ void literal(WORD *w) {
   }
 
   u64 val = spop();
-  WORD *lit = find_word("LIT", 3);
 
-  code_space[code_idx++] = (u64)lit;
-  code_space[code_idx++] = val;
+  emit_code((u64)word_lit);
+  emit_code(val);
 }
 
 void source_word(WORD *w) {
@@ -251,11 +432,14 @@ void add_word(const char *name, void (*code)(WORD *),
     print_source_line();
     return;
   }
+  dict_mark_take();
   WORD *w = &dictionary[here++];
   w->name = name;
   w->code = code;
   w->continuation = (u64 *)continuation_wordlist;
   w->flags = flags;
+  w->op = continuation_wordlist ? OP_DOCOL : primitive_op(code);
+  dict_index_insert(w);
 }
 
 int streq_len(const char *a, const char *b, u64 len) {
@@ -265,10 +449,51 @@ int streq_len(const char *a, const char *b, u64 len) {
   return b[len] == '\0';
 }
 
+// FNV-1a
+u64 hash_name(const char *name, u64 len) {
+  u64 h = 14695981039346656037ULL;
+  for (u64 x = 0; x < len; x += 1) {
+    h ^= (unsigned char)name[x];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void dict_index_insert(WORD *w) {
+  if (!dict_index)
+    return;
+  u64 len = strlen(w->name);
+  u64 mask = dict_index_size - 1;
+  u64 slot = hash_name(w->name, len) & mask;
+
+  while (dict_index[slot]) {
+    // same name already indexed: shadow it
+    if (streq_len(w->name, dictionary[dict_index[slot] - 1].name, len))
+      break;
+    slot = (slot + 1) & mask;
+  }
+  dict_log_write(slot);
+  dict_index[slot] = (u64)(w - dictionary) + 1;
+}
+
 WORD *find_word(const char *name, u64 len) {
-  for (i64 x = here - 1; x >= 0; x -= 1) {
-    if (streq_len(name, dictionary[x].name, len))
-      return &dictionary[x];
+  // no index yet (config.fs mini interpreter): plain backwards scan
+  if (!dict_index) {
+    for (i64 x = here - 1; x >= 0; x -= 1) {
+      if (streq_len(name, dictionary[x].name, len))
+        return &dictionary[x];
+    }
+    return NULL;
+  }
+
+  u64 mask = dict_index_size - 1;
+  u64 slot = hash_name(name, len) & mask;
+
+  while (dict_index[slot]) {
+    WORD *w = &dictionary[dict_index[slot] - 1];
+    if (streq_len(name, w->name, len))
+      return w;
+    slot = (slot + 1) & mask;
   }
 
   return NULL;
@@ -307,8 +532,7 @@ void words(WORD *w) {
 void type(WORD *w) {
   UNUSED(w);
   if (f_mode == COMPILE) {
-    WORD *word = find_word("TYPE", 4);
-    code_space[code_idx++] = (u64)word;
+    emit_code((u64)word_type);
     return;
   }
   if (sp < 2) {
@@ -376,7 +600,7 @@ void rshift_word(WORD *w) {
 // primitive: +
 void add(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -387,7 +611,7 @@ void add(WORD *w) {
 }
 void substract(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -398,7 +622,7 @@ void substract(WORD *w) {
 }
 void multiply(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -409,7 +633,7 @@ void multiply(WORD *w) {
 }
 void dup_word(WORD *w) {
   UNUSED(w);
-  if (sp == 0) {
+  if (CHECKED(sp == 0)) {
     printf("%s[ERROR] Stack is empty \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -418,7 +642,7 @@ void dup_word(WORD *w) {
 }
 void swap(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -446,7 +670,7 @@ void double_swap(WORD *w) {
 }
 void over(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -476,7 +700,7 @@ void slash_mod(WORD *w) {
 }
 void rot(WORD *w) {
   UNUSED(w);
-  if (sp < 3) {
+  if (CHECKED(sp < 3)) {
     printf("%s[ERROR] Stack is to small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -490,7 +714,7 @@ void rot(WORD *w) {
 }
 void reverse_rot(WORD *w) {
   UNUSED(w);
-  if (sp < 3) {
+  if (CHECKED(sp < 3)) {
     printf("%s[ERROR] Stack is to small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -521,7 +745,7 @@ void double_drop(WORD *w) {
 }
 void equals_zero(WORD *w) {
   UNUSED(w);
-  if (sp == 0) {
+  if (CHECKED(sp == 0)) {
     printf("%s[ERROR] Stack is empty \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -531,7 +755,7 @@ void equals_zero(WORD *w) {
 }
 void equals(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -542,7 +766,7 @@ void equals(WORD *w) {
 }
 void lessthan(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -553,7 +777,7 @@ void lessthan(WORD *w) {
 }
 void morethan(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small \n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -636,16 +860,66 @@ void clear_stack_word(WORD *w) {
   }
   sp = 0;
 }
+// Data, blob and code space each live at the start of a PROT_NONE
+// reservation of SPACE_RESERVE bytes (or their configured size, if that is
+// larger). Growing one commits more pages with mprotect, so the spaces never
+// move: addresses from HERE, WORD data fields and compiled pointers stay
+// valid, and nothing is copied.
+#define SPACE_RESERVE (1ull << 34)
+
+u64 data_reserve = 0; // bytes reserved at data_space
+u64 bytes_reserve = 0; // bytes reserved at bytes_space
+u64 code_reserve = 0; // bytes reserved at code_space
+
+u64 page_round(u64 n) {
+  u64 page = (u64)sysconf(_SC_PAGESIZE);
+  return (n + page - 1) & ~(page - 1);
+}
+
+// Reserves the range for a space at `hint` if that is free, anywhere else
+// otherwise, and commits its first `size` bytes.
+void *reserve_space(u64 hint, u64 size, int prot, u64 *reserved) {
+  u64 len = page_round(size > SPACE_RESERVE ? size : SPACE_RESERVE);
+  int flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE;
+  void *p = MAP_FAILED;
+  if (hint)
+    p = mmap((void *)hint, len, PROT_NONE, flags | MAP_FIXED_NOREPLACE, -1,
+             0);
+  if (p == MAP_FAILED)
+    p = mmap(NULL, len, PROT_NONE, flags, -1, 0);
+  if (p == MAP_FAILED)
+    return p;
+  if (size && mprotect(p, page_round(size), prot) == -1) {
+    munmap(p, len);
+    return MAP_FAILED;
+  }
+  *reserved = len;
+  return p;
+}
+
+// Commits bytes [old, new) of a reservation
+int commit_space(void *base, u64 old, u64 new, u64 reserved, int prot) {
+  if (new > reserved) {
+    errno = ENOMEM;
+    return 0;
+  }
+  u64 from = page_round(old);
+  u64 to = page_round(new);
+  return to <= from ||
+         mprotect((char *)base + from, to - from, prot) == 0;
+}
+
 void clear_data_word(WORD *w) {
   UNUSED(w);
-  if (!data_space) {
+  if (!DATA_SIZE) {
     printf("%s[ERROR] There is no memory allocated in Data space to clear\n%s",
            SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
   }
-  munmap(data_space, DATA_SIZE * CELLSIZE);
-  data_space = NULL;
+  // give the pages back but keep the reservation, data_space stays put
+  madvise(data_space, page_round(DATA_SIZE * CELLSIZE), MADV_DONTNEED);
+  mprotect(data_space, page_round(DATA_SIZE * CELLSIZE), PROT_NONE);
   dp = 0;
   DATA_SIZE = 0;
 }
@@ -657,22 +931,22 @@ void grow_data(WORD *w) {
     return;
   }
   u64 n = spop();
-  void *new = mremap(data_space, DATA_SIZE * CELLSIZE,
-                     (DATA_SIZE + n) * CELLSIZE, MREMAP_MAYMOVE);
-  if (new == MAP_FAILED) {
+  if (!commit_space(data_space, DATA_SIZE * CELLSIZE,
+                    (DATA_SIZE + n) * CELLSIZE, data_reserve,
+                    PROT_READ | PROT_WRITE)) {
     printf("%s[ERROR] Could not regrow Data memory\n%s", SETREDCOLOR,
            RESETALLSTYLES);
-    printf("%s[ERROR] MREMAP failed to regrow to %llu CELLS in "
+    printf("%s[ERROR] MPROTECT failed to regrow to %llu CELLS in "
            "virtual memory for "
-           "data space (old size: %llu )\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, (u64)DATA_SIZE + n, DATA_SIZE, strerror(errno),
-           RESETALLSTYLES);
+           "data space (old size: %llu, reserved: %llu CELLS)\n[SYS MSG] "
+           "%s%s\n",
+           SETREDCOLOR, (u64)DATA_SIZE + n, DATA_SIZE,
+           data_reserve / CELLSIZE, strerror(errno), RESETALLSTYLES);
 
     print_source_line();
     return;
   }
   DATA_SIZE += n;
-  data_space = (u64 *)new;
 }
 int c_next_token(char **addr, u64 *len);
 
@@ -693,7 +967,12 @@ void alloc_code_word(WORD *w) {
     print_source_line();
   }
   u64 increment = spop();
-
+  if (!ensure_code(increment)) {
+    printf("%s[ERROR] Code space is full (%llu CELLS reserved)%s\n",
+           SETREDCOLOR, code_reserve / CELLSIZE, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
   code_idx += increment;
 }
 
@@ -730,7 +1009,7 @@ void alloc_data(WORD *w) {
 
 void at_ptr(WORD *w) {
   UNUSED(w);
-  if (sp == 0) {
+  if (CHECKED(sp == 0)) {
     printf("%s[ERROR] Stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -740,7 +1019,7 @@ void at_ptr(WORD *w) {
 }
 void write_ptr(WORD *w) {
   UNUSED(w);
-  if (sp < 2) {
+  if (CHECKED(sp < 2)) {
     printf("%s[ERROR] Stack is too small\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -757,12 +1036,12 @@ void write_ptr(WORD *w) {
 }
 void to_r(WORD *w) {
   UNUSED(w);
-  if (sp == 0) {
+  if (CHECKED(sp == 0)) {
     printf("%s[ERROR] Stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
   }
-  if (rsp >= STACK_SIZE) {
+  if (CHECKED(rsp >= STACK_SIZE)) {
     printf("%s[ERROR] Return stack overflow\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
@@ -771,12 +1050,12 @@ void to_r(WORD *w) {
 }
 void from_r(WORD *w) {
   UNUSED(w);
-  if (rsp == 0) {
+  if (CHECKED(rsp == 0)) {
     printf("%s[ERROR] Return stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
   }
-  if (sp >= STACK_SIZE) {
+  if (CHECKED(sp >= STACK_SIZE)) {
     printf("%s[ERROR] Stack is full and cant return value from Return stack to "
            "main stack\n%s",
            SETREDCOLOR, RESETALLSTYLES);
@@ -797,6 +1076,125 @@ char *save_string(const char *src, u64 len) {
   return dst;
 }
 
+// Transient strings
+//
+// Interpreted s" strings, INCLUDE file names and SHELL-CMD commands are only
+// needed for a moment, so they are copied into a ring of TRANSIENT_SLOTS
+// buffers instead of blob space. A string stays valid until
+// TRANSIENT_SLOTS more have been made. Longer strings go to blob space.
+#define TRANSIENT_SLOTS 8
+#define TRANSIENT_SIZE 512
+
+char transient_ring[TRANSIENT_SLOTS][TRANSIENT_SIZE];
+u64 transient_next = 0;
+
+char *transient_string(const char *src, u64 len) {
+  if (len >= TRANSIENT_SIZE)
+    return save_string(src, len);
+  char *dst = transient_ring[transient_next];
+  transient_next = (transient_next + 1) % TRANSIENT_SLOTS;
+  memmove(dst, src, len);
+  dst[len] = '\0';
+  return dst;
+}
+
+// Interned names
+//
+// Word names are saved once in blob space and shared by every word with the
+// same name, found through an open addressing hash set of the saved copies.
+char **intern_table = NULL;
+u64 intern_cap = 0; // a power of two
+u64 intern_len = 0;
+
+u64 intern_hash(const char *s, u64 len) {
+  u64 h = 14695981039346656037ULL;
+  for (u64 x = 0; x < len; x++)
+    h = (h ^ (unsigned char)s[x]) * 1099511628211ULL;
+  return h;
+}
+
+int intern_insert(char *s) {
+  if ((intern_len + 1) * 2 > intern_cap) {
+    u64 cap = intern_cap ? intern_cap * 2 : 256;
+    char **table = calloc(cap, sizeof(char *));
+    if (!table)
+      return 0;
+    for (u64 x = 0; x < intern_cap; x++) {
+      if (!intern_table[x])
+        continue;
+      u64 slot = intern_hash(intern_table[x], strlen(intern_table[x]));
+      while (table[slot & (cap - 1)])
+        slot++;
+      table[slot & (cap - 1)] = intern_table[x];
+    }
+    free(intern_table);
+    intern_table = table;
+    intern_cap = cap;
+  }
+  u64 slot = intern_hash(s, strlen(s));
+  while (intern_table[slot & (intern_cap - 1)])
+    slot++;
+  intern_table[slot & (intern_cap - 1)] = s;
+  intern_len++;
+  return 1;
+}
+
+char *intern_find(const char *src, u64 len) {
+  if (!intern_cap)
+    return NULL;
+  u64 slot = intern_hash(src, len);
+  for (char *s; (s = intern_table[slot & (intern_cap - 1)]); slot++) {
+    if (strlen(s) == len && memcmp(s, src, len) == 0)
+      return s;
+  }
+  return NULL;
+}
+
+void intern_remove(const char *s) {
+  if (!intern_cap)
+    return;
+  u64 mask = intern_cap - 1;
+  u64 slot = intern_hash(s, strlen(s)) & mask;
+  while (intern_table[slot] && intern_table[slot] != s)
+    slot = (slot + 1) & mask;
+  if (!intern_table[slot])
+    return;
+  intern_table[slot] = NULL;
+  intern_len--;
+  // put the rest of the probe run back so lookups still reach it
+  for (slot = (slot + 1) & mask; intern_table[slot];
+       slot = (slot + 1) & mask) {
+    char *t = intern_table[slot];
+    intern_table[slot] = NULL;
+    intern_len--;
+    intern_insert(t);
+  }
+}
+
+char *intern_string(const char *src, u64 len) {
+  char *s = intern_find(src, len);
+  if (s)
+    return s;
+  s = save_string(src, len);
+  intern_insert(s); // if this fails the name is just not shared
+  return s;
+}
+
+// Rebuilds the set from the names in the dictionary, after blob space was
+// rolled back or an image was loaded.
+void intern_rebuild(void) {
+  free(intern_table);
+  intern_table = NULL;
+  intern_cap = 0;
+  intern_len = 0;
+  for (u64 x = 0; x < here; x++) {
+    char *s = (char *)dictionary[x].name;
+    if (s >= bytes_space && s < bytes_space + bytes_p &&
+        !intern_find(s, strlen(s)))
+      intern_insert(s);
+  }
+}
+
 void ensure_data(u64 cells);
 
 // TODO: add this so word s" can save the string
@@ -834,7 +1232,8 @@ void create_struct(WORD *ww) {
     return;
   }
 
-  char *name = save_string(addr, len);
+  dict_mark_take();
+  char *name = intern_string(addr, len);
 
   if (!name) {
     printf("%s[ERROR] CREATE: strdup failed \n%s", SETREDCOLOR, RESETALLSTYLES);
@@ -848,7 +1247,7 @@ void create_struct(WORD *ww) {
     print_source_line();
     return;
   }
-  if (!data_space) {
+  if (!DATA_SIZE) {
     ensure_data(1);
   }
 
@@ -860,6 +1259,8 @@ void create_struct(WORD *ww) {
   // the start of the structure
   w->continuation = NULL;
   w->code = push_ptr_code;
+  w->op = OP_PUSHPTR;
+  dict_index_insert(w);
   last_created = w;
 }
 
@@ -878,7 +1279,7 @@ void comma(WORD *w) {
 void see_word(WORD *w) {
   UNUSED(w);
 
-  execute(find_word("PARSE-NAME", 10));
+  execute(word_parse_name);
   u64 len = spop();
   char *addr = (char *)spop();
 
@@ -900,21 +1301,40 @@ void see_word(WORD *w) {
   printf("\n");
 
   // TODO: ->code & ->continuantion=NULL is a primitive implementation
-  if (!w_tosee->continuation) {
+  u64 *body = w_tosee->continuation;
+  if (w_tosee->flags & NATIVE) {
+    printf(" <native> threaded body:\n");
+    body = w_tosee->data;
+  } else if (w_tosee->flags & COMPILED_C) {
+    printf(" <compiled C> threaded body:\n");
+    body = w_tosee->data;
+  } else if (w_tosee->flags & MACHINE) {
+    printf(" <machine code at %p>\n;\n", (void *)w_tosee->code);
+    return;
+  } else if (!body) {
     printf(" <primitive>\n;\n");
     return;
   }
 
-  u64 *p = w_tosee->continuation;
-
+  u64 *p = body;
   while (*p) {
     WORD *cw = (WORD *)*p++;
 
-    if (cw == find_word("LIT", 3)) {
-      u64 val = *p++;
-      printf("  LIT %llu\n", val);
-    } else {
+    switch (word_operand(cw)) {
+    case OPERAND_VALUE:
+      printf("  %s %llu\n", cw->name, *p++);
+      break;
+    case OPERAND_CODE:
+      // branch targets are shown as a cell offset inside the definition
+      printf("  %s -> %lld\n", cw->name,
+             (i64)((u64 *)*p++ - body));
+      break;
+    case OPERAND_WORD:
+      printf("  %s %s\n", cw->name, ((WORD *)*p++)->name);
+      break;
+    default:
       printf("  %s\n", cw->name);
+      break;
     }
   }
 
@@ -923,7 +1343,7 @@ void see_word(WORD *w) {
 
 void constant_var_word(WORD *w) {
   UNUSED(w);
-  execute(find_word("PARSE-NAME", 10));
+  execute(word_parse_name);
   u64 len = spop();
   char *addr = (char *)spop();
   if (len == 0) {
@@ -933,7 +1353,8 @@ void constant_var_word(WORD *w) {
     return;
   }
 
-  char *name = save_string(addr, len);
+  dict_mark_take();
+  char *name = intern_string(addr, len);
 
   if (!name) {
     printf("%s[ERROR] constant expects a name\n%s", SETREDCOLOR,
@@ -958,6 +1379,8 @@ void constant_var_word(WORD *w) {
   data_space[dp++] = val;
   nw->code = push_val_code;
   nw->continuation = NULL;
+  nw->op = OP_PUSHVAL;
+  dict_index_insert(nw);
 }
 
 void ensure_data(u64 cells) {
@@ -967,19 +1390,21 @@ void ensure_data(u64 cells) {
   while (new_cap < dp + cells)
     new_cap *= 2;
 
-  void *new = mremap(data_space, DATA_SIZE * CELLSIZE, new_cap * CELLSIZE,
-                     MREMAP_MAYMOVE);
-  if (new == MAP_FAILED) {
-    printf("%s[ERROR] MREMAP failed to regrow to %llu CELLS in "
+  if (new_cap * CELLSIZE > data_reserve &&
+      (dp + cells) * CELLSIZE <= data_reserve)
+    new_cap = data_reserve / CELLSIZE;
+  if (!commit_space(data_space, DATA_SIZE * CELLSIZE, new_cap * CELLSIZE,
+                    data_reserve, PROT_READ | PROT_WRITE)) {
+    printf("%s[ERROR] MPROTECT failed to regrow to %llu CELLS in "
            "virtual memory for "
-           "data space (old size: %llu )\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, (u64)new_cap, DATA_SIZE, strerror(errno),
-           RESETALLSTYLES);
+           "data space (old size: %llu, reserved: %llu CELLS)\n[SYS MSG] "
+           "%s%s\n",
+           SETREDCOLOR, (u64)new_cap, DATA_SIZE, data_reserve / CELLSIZE,
+           strerror(errno), RESETALLSTYLES);
 
     print_source_line();
     return;
   }
-  data_space = (u64 *)new;
   DATA_SIZE = new_cap;
 }
 
@@ -990,688 +1415,5054 @@ void ensure_chars(u64 chars) {
   while (new_cap < bytes_p + chars)
     new_cap *= 2;
 
-  void *new = mremap(bytes_space, MAX_BYTES_SPACE, new_cap, MREMAP_MAYMOVE);
-  if (new == MAP_FAILED) {
-    printf("%s[ERROR] MREMAP failed to regrow to %llu bytes in "
+  if (new_cap > bytes_reserve && bytes_p + chars <= bytes_reserve)
+    new_cap = bytes_reserve;
+  if (!commit_space(bytes_space, MAX_BYTES_SPACE, new_cap, bytes_reserve,
+                    PROT_READ | PROT_WRITE)) {
+    printf("%s[ERROR] MPROTECT failed to regrow to %llu bytes in "
            "virtual memory for "
-           "char space (old size: %llu )\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, (u64)new_cap, MAX_BYTES_SPACE, strerror(errno),
-           RESETALLSTYLES);
+           "char space (old size: %llu, reserved: %llu)\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, (u64)new_cap, MAX_BYTES_SPACE, bytes_reserve,
+           strerror(errno), RESETALLSTYLES);
     print_source_line();
     return;
   }
-  bytes_space = (char *)new;
   MAX_BYTES_SPACE = new_cap;
 }
 
-void bye(WORD *w) {
-  UNUSED(w);
-  exit(EXIT_SUCCESS);
+// Appends a cell to code space, growing it if needed
+void emit_code(u64 v) {
+  if (!ensure_code(1)) {
+    printf("%s[ERROR] Code space is full (%llu CELLS reserved)%s\n",
+           SETREDCOLOR, code_reserve / CELLSIZE, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  code_space[code_idx++] = v;
 }
 
-// : (compile mode)
-void colon(WORD *ww) {
-  UNUSED(ww);
-  if (cfsp != 0) {
-    printf("%s[ERROR] Unresolved control structure\n%s", SETREDCOLOR,
-           RESETALLSTYLES);
-    print_source_line();
-    exit(EXIT_FAILURE);
+// Makes room for `cells` more cells of code space. Returns 0 if the
+// reservation is exhausted.
+int ensure_code(u64 cells) {
+  if (code_idx + cells <= MAX_CODE_SPACE)
+    return 1;
+  u64 new_cap = MAX_CODE_SPACE ? MAX_CODE_SPACE : 1024;
+  while (new_cap < code_idx + cells)
+    new_cap *= 2;
+  if (new_cap * CELLSIZE > code_reserve &&
+      (code_idx + cells) * CELLSIZE <= code_reserve)
+    new_cap = code_reserve / CELLSIZE;
+  if (!commit_space(code_space, MAX_CODE_SPACE * CELLSIZE, new_cap * CELLSIZE,
+                    code_reserve, PROT_READ | PROT_WRITE))
+    return 0;
+  MAX_CODE_SPACE = new_cap;
+  return 1;
+}
+
+// Heap
+//
+// ALLOCATE, FREE and RESIZE serve requests of up to HEAP_MAX_SMALL bytes
+// from size-class pools (16, 32, ... 2048 bytes) that are carved out of
+// HEAP_SLAB byte mappings, and larger ones from a mapping of their own.
+// Every block starts with a HEAP_HEADER right below the address handed out;
+// FREE and RESIZE use it to find the pool. Slabs are HEAP_SLAB aligned, and
+// they and the large blocks are kept in a table of live mappings, so an
+// address is only taken for a block (and its header read) when it lies
+// where one can be. Stale and foreign addresses get EINVAL. The ior results
+// are 0 or an errno value.
+#define HEAP_CLASSES 8
+#define HEAP_MIN_SIZE 16
+#define HEAP_MAX_SMALL (HEAP_MIN_SIZE << (HEAP_CLASSES - 1))
+#define HEAP_SLAB (64 * 1024)
+#define HEAP_USED 0x6465737550414548ull // "HEAPused"
+#define HEAP_LARGE 0x656772614c504548ull // "HEPLarge"
+#define HEAP_FREE 0x6565726650414548ull // "HEAPfree"
+
+typedef struct heap_header {
+  u64 magic;
+  u64 size; // pool index, or the mapping length of a large block
+} HEAP_HEADER;
+
+typedef struct heap_pool {
+  HEAP_HEADER *free; // free slots, linked through their size field
+  u64 slots;
+  u64 used;
+} HEAP_POOL;
+
+HEAP_POOL heap_pools[HEAP_CLASSES];
+u64 heap_large_count = 0;
+u64 heap_large_bytes = 0;
+
+// live mappings, open addressing. A large block is keyed by its header, a
+// slab by its base
+typedef struct heap_map {
+  u64 addr; // 0 empty, HEAP_MAP_DELETED deleted
+  u64 kind; // pool index of a slab, HEAP_CLASSES for a large block
+} HEAP_MAP;
+
+#define HEAP_MAP_DELETED 1
+#define HEAP_MAP_LARGE HEAP_CLASSES
+
+HEAP_MAP *heap_maps = NULL;
+u64 heap_maps_size = 0; // power of two
+u64 heap_maps_used = 0; // live and deleted entries
+u64 heap_maps_live = 0;
+
+u64 heap_class_size(u64 c) { return (u64)HEAP_MIN_SIZE << c; }
+
+u64 heap_map_hash(u64 addr) {
+  u64 h = (addr >> 12) * 0x9E3779B97F4A7C15ull;
+  return h ^ (h >> 32);
+}
+
+HEAP_MAP *heap_map_find(u64 addr) {
+  if (!heap_maps_size)
+    return NULL;
+  u64 mask = heap_maps_size - 1;
+  for (u64 x = heap_map_hash(addr) & mask;; x = (x + 1) & mask) {
+    if (heap_maps[x].addr == addr)
+      return &heap_maps[x];
+    if (!heap_maps[x].addr)
+      return NULL;
   }
+}
 
-  execute(find_word("PARSE-NAME", 10));
-  u64 len = spop();
-  char *addr = (char *)spop();
-  if (len == 0) {
-    printf("%s[ERROR] Expected word name after ':'\n%s", SETREDCOLOR,
-           RESETALLSTYLES);
-    print_source_line();
-    return;
+// makes sure one more heap_map_add fits, 0 when out of memory
+int heap_map_room(void) {
+  if ((heap_maps_used + 1) * 2 <= heap_maps_size)
+    return 1;
+  u64 size = 64;
+  while ((heap_maps_live + 1) * 4 > size)
+    size *= 2;
+  HEAP_MAP *old = heap_maps;
+  u64 old_size = heap_maps_size;
+  heap_maps = calloc(size, sizeof(HEAP_MAP));
+  if (!heap_maps) {
+    heap_maps = old;
+    return 0;
+  }
+  heap_maps_size = size;
+  heap_maps_used = heap_maps_live;
+  for (u64 x = 0; x < old_size; x += 1) {
+    if (old[x].addr <= HEAP_MAP_DELETED)
+      continue;
+    u64 y = heap_map_hash(old[x].addr) & (size - 1);
+    while (heap_maps[y].addr)
+      y = (y + 1) & (size - 1);
+    heap_maps[y] = old[x];
   }
+  free(old);
+  return 1;
+}
 
-  char *name = save_string(addr, len);
+// needs heap_map_room() first
+void heap_map_add(u64 addr, u64 kind) {
+  u64 mask = heap_maps_size - 1;
+  u64 x = heap_map_hash(addr) & mask;
+  while (heap_maps[x].addr > HEAP_MAP_DELETED)
+    x = (x + 1) & mask;
+  if (!heap_maps[x].addr)
+    heap_maps_used++;
+  heap_maps[x].addr = addr;
+  heap_maps[x].kind = kind;
+  heap_maps_live++;
+}
 
-  if (!name) {
-    printf("%s[ERROR] Expected word name after ':'\n%s", SETREDCOLOR,
-           RESETALLSTYLES);
-    print_source_line();
-    return;
+void heap_map_del(HEAP_MAP *m) {
+  m->addr = HEAP_MAP_DELETED;
+  heap_maps_live--;
+}
+
+void *heap_alloc(u64 n) {
+  if (n > HEAP_MAX_SMALL) {
+    u64 len = page_round(n + sizeof(HEAP_HEADER));
+    if (len < n || !heap_map_room())
+      return NULL;
+    HEAP_HEADER *h = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (h == MAP_FAILED)
+      return NULL;
+    heap_map_add((u64)h, HEAP_MAP_LARGE);
+    h->magic = HEAP_LARGE;
+    h->size = len;
+    heap_large_count++;
+    heap_large_bytes += len;
+    return h + 1;
+  }
+
+  u64 c = 0;
+  while (heap_class_size(c) < n)
+    c++;
+  HEAP_POOL *pool = &heap_pools[c];
+  if (!pool->free) {
+    u64 slot = heap_class_size(c) + sizeof(HEAP_HEADER);
+    if (!heap_map_room())
+      return NULL;
+    // map twice the size and trim it to an aligned slab, so the slab of a
+    // header is found by masking its address
+    char *raw = mmap(NULL, 2 * HEAP_SLAB, PROT_READ | PROT_WRITE,
+                     MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (raw == MAP_FAILED)
+      return NULL;
+    char *slab = (char *)(((u64)raw + HEAP_SLAB - 1) & ~(u64)(HEAP_SLAB - 1));
+    u64 head = (u64)(slab - raw);
+    if (head)
+      munmap(raw, head);
+    munmap(slab + HEAP_SLAB, HEAP_SLAB - head);
+    heap_map_add((u64)slab, c);
+    for (u64 x = 0; x + slot <= HEAP_SLAB; x += slot) {
+      HEAP_HEADER *h = (HEAP_HEADER *)(slab + x);
+      h->magic = HEAP_FREE;
+      h->size = (u64)pool->free;
+      pool->free = h;
+      pool->slots++;
+    }
   }
-  WORD *nw = &dictionary[here++];
-  nw->name = name;
-  nw->code = NULL;
-  nw->continuation = &code_space[code_idx];
-  current_def = nw;
-  f_mode = COMPILE;
+  HEAP_HEADER *h = pool->free;
+  pool->free = (HEAP_HEADER *)h->size;
+  h->magic = HEAP_USED;
+  h->size = c;
+  pool->used++;
+  return h + 1;
 }
-// ;(end compile mode)
-void semicolon(WORD *w) {
-  UNUSED(w);
-  code_space[code_idx++] = (u64)NULL;
-  f_mode = INTERPRET;
-  current_def = NULL;
+
+// The header of a live block, or NULL. Only reads memory the heap has
+// mapped
+HEAP_HEADER *heap_header(void *addr) {
+  if ((u64)addr <= HEAP_SLAB || (u64)addr % sizeof(HEAP_HEADER))
+    return NULL;
+  HEAP_HEADER *h = (HEAP_HEADER *)addr - 1;
+  HEAP_MAP *m = heap_map_find((u64)h);
+  if (m && m->kind == HEAP_MAP_LARGE)
+    return h;
+  m = heap_map_find((u64)h & ~(u64)(HEAP_SLAB - 1));
+  if (!m || m->kind == HEAP_MAP_LARGE)
+    return NULL;
+  u64 slot = heap_class_size(m->kind) + sizeof(HEAP_HEADER);
+  u64 off = (u64)h - m->addr;
+  if (off % slot || off + slot > HEAP_SLAB)
+    return NULL;
+  if (h->magic == HEAP_USED && h->size == m->kind)
+    return h;
+  return NULL;
 }
-// if\else\then branching
-void zero_branch(WORD *w) {
-  UNUSED(w);
-  u64 flag = spop();
-  // conditional argument
-  u64 target = *ip++;
-  if (flag == 0)
-    ip = (u64 *)target;
+
+u64 heap_capacity(HEAP_HEADER *h) {
+  return h->magic == HEAP_USED ? heap_class_size(h->size)
+                               : h->size - sizeof(HEAP_HEADER);
 }
-void branch(WORD *w) {
-  UNUSED(w);
-  u64 target = *ip++;
-  ip = (u64 *)target;
+
+void heap_free(HEAP_HEADER *h) {
+  if (h->magic == HEAP_LARGE) {
+    heap_large_count--;
+    heap_large_bytes -= h->size;
+    heap_map_del(heap_map_find((u64)h));
+    munmap(h, h->size);
+    return;
+  }
+  HEAP_POOL *pool = &heap_pools[h->size];
+  h->magic = HEAP_FREE;
+  h->size = (u64)pool->free;
+  pool->free = h;
+  pool->used--;
 }
-void if_word(WORD *w) {
+
+void allocate_word(WORD *w) {
   UNUSED(w);
-  if (f_mode != COMPILE) {
-    printf("%s[ERROR] IF only valid in compile mode\n%s", SETREDCOLOR,
+  if (sp < 1) {
+    printf("%s[ERROR] ALLOCATE expects a size%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  WORD *zb = find_word("0BRANCH", 7);
-  code_space[code_idx++] = (u64)zb;
-  code_space[code_idx++] = 0;
-  CFPUSH(&code_space[code_idx - 1]);
+  void *p = heap_alloc(spop());
+  spush((u64)p);
+  spush(p ? 0 : ENOMEM);
 }
-void else_word(WORD *w) {
+
+void free_word(WORD *w) {
   UNUSED(w);
-  if (f_mode != COMPILE) {
-    printf("%s[ERROR] ELSE only valid in compile mode\n%s", SETREDCOLOR,
+  if (sp < 1) {
+    printf("%s[ERROR] FREE expects an address%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  WORD *br = find_word("BRANCH", 6);
-  code_space[code_idx++] = (u64)br;
-  code_space[code_idx++] = 0;
-  u64 *if_placeholder = CFPOP();
-  *if_placeholder = (u64)&code_space[code_idx];
-  CFPUSH(&code_space[code_idx - 1]);
+  HEAP_HEADER *h = heap_header((void *)spop());
+  if (!h) {
+    spush(EINVAL);
+    return;
+  }
+  heap_free(h);
+  spush(0);
 }
-void then_word(WORD *w) {
+
+void resize_word(WORD *w) {
   UNUSED(w);
-  if (f_mode != COMPILE) {
-    printf("%s[ERROR] THEN only valid in compile mode\n%s", SETREDCOLOR,
+  if (sp < 2) {
+    printf("%s[ERROR] RESIZE expects an address and a size%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  u64 *placeholder = CFPOP();
-  *placeholder = (u64)&code_space[code_idx];
+  u64 n = spop();
+  void *addr = (void *)spop();
+  if (!addr) { // like ALLOCATE
+    void *p = heap_alloc(n);
+    spush((u64)p);
+    spush(p ? 0 : ENOMEM);
+    return;
+  }
+  HEAP_HEADER *h = heap_header(addr);
+  if (!h) {
+    spush((u64)addr);
+    spush(EINVAL);
+    return;
+  }
+  u64 cap = heap_capacity(h);
+  if (n <= cap && (h->magic == HEAP_USED || n > HEAP_MAX_SMALL)) {
+    spush((u64)addr); // still fits its block
+    spush(0);
+    return;
+  }
+  if (h->magic == HEAP_LARGE && n > HEAP_MAX_SMALL) {
+    // large to large, let the kernel move the pages
+    u64 len = page_round(n + sizeof(HEAP_HEADER));
+    HEAP_HEADER *m = heap_map_room()
+                         ? mremap(h, h->size, len, MREMAP_MAYMOVE)
+                         : MAP_FAILED;
+    if (m == MAP_FAILED) {
+      spush((u64)addr);
+      spush(ENOMEM);
+      return;
+    }
+    heap_map_del(heap_map_find((u64)h));
+    heap_map_add((u64)m, HEAP_MAP_LARGE);
+    heap_large_bytes += len - m->size;
+    m->size = len;
+    spush((u64)(m + 1));
+    spush(0);
+    return;
+  }
+  void *p = heap_alloc(n);
+  if (!p) {
+    spush((u64)addr);
+    spush(ENOMEM);
+    return;
+  }
+  memcpy(p, addr, n < cap ? n : cap);
+  heap_free(h);
+  spush((u64)p);
+  spush(0);
 }
-// begin\while\repeat branching
-void begin(WORD *w) {
+
+// Arenas
+//
+// ARENA-NEW maps a region with an ARENA header at its start. ARENA-ALLOC
+// bumps a pointer through it, ARENA-RESET frees everything allocated from
+// it at once and ARENA-FREE unmaps it. Pages are only backed once touched,
+// so a generous size costs nothing up front.
+#define ARENA_MAGIC 0x414e455241ull // "ARENA"
+
+typedef struct arena {
+  u64 magic;
+  u64 size; // usable bytes after the header
+  u64 used;
+  u64 peak;
+  struct arena *next;
+  struct arena *prev;
+} ARENA;
+
+ARENA *arenas = NULL;
+
+ARENA *arena_check(u64 a, const char *word) {
+  ARENA *arena = (ARENA *)a;
+  for (ARENA *x = arenas; x; x = x->next) {
+    if (x == arena)
+      return arena;
+  }
+  printf("%s[ERROR] %s: %llu is not an arena%s", SETREDCOLOR, word, a,
+         RESETALLSTYLES);
+  print_source_line();
+  return NULL;
+}
+
+void arena_new_word(WORD *w) {
   UNUSED(w);
-  if (f_mode != COMPILE) {
-    printf("%s[ERROR] BEGIN is only valid in compile mode\n%s", SETREDCOLOR,
+  if (sp < 1) {
+    printf("%s[ERROR] ARENA-NEW expects a size%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  CFPUSH(&code_space[code_idx]);
+  u64 n = spop();
+  u64 len = page_round(n + sizeof(ARENA));
+  ARENA *a = len < n ? MAP_FAILED
+                     : mmap(NULL, len, PROT_READ | PROT_WRITE,
+                            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1,
+                            0);
+  if (a == MAP_FAILED) {
+    spush(0);
+    spush(ENOMEM);
+    return;
+  }
+  a->magic = ARENA_MAGIC;
+  a->size = len - sizeof(ARENA);
+  a->used = 0;
+  a->peak = 0;
+  a->prev = NULL;
+  a->next = arenas;
+  if (arenas)
+    arenas->prev = a;
+  arenas = a;
+  spush((u64)a);
+  spush(0);
 }
-void while_word(WORD *w) {
+
+void arena_alloc_word(WORD *w) {
   UNUSED(w);
-  if (f_mode != COMPILE) {
-    printf("%s[ERROR] WHILE is only valid in compile mode\n%s", SETREDCOLOR,
-           RESETALLSTYLES);
+  if (sp < 2) {
+    printf("%s[ERROR] ARENA-ALLOC expects an arena and a size%s",
+           SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
   }
-  WORD *zb = find_word("0BRANCH", 7);
-  code_space[code_idx++] = (u64)zb;
-  code_space[code_idx++] = 0;
-  CFPUSH(&code_space[code_idx - 1]);
+  u64 n = spop();
+  ARENA *a = arena_check(spop(), "ARENA-ALLOC");
+  if (!a)
+    return;
+  u64 at = (a->used + CELLSIZE - 1) & ~(CELLSIZE - 1);
+  if (n > a->size || at > a->size - n) {
+    spush(0);
+    spush(ENOMEM);
+    return;
+  }
+  a->used = at + n;
+  if (a->used > a->peak)
+    a->peak = a->used;
+  spush((u64)((char *)(a + 1) + at));
+  spush(0);
 }
 
-void repeat(WORD *w) {
+void arena_reset_word(WORD *w) {
   UNUSED(w);
-  if (f_mode != COMPILE) {
-    printf("%s[ERROR] REPEAT is only valid in compile mode\n%s", SETREDCOLOR,
+  if (sp < 1) {
+    printf("%s[ERROR] ARENA-RESET expects an arena%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  u64 *while_placeholder = CFPOP();
-  u64 *begin_addr = CFPOP();
-  WORD *br = find_word("BRANCH", 6);
-  code_space[code_idx++] = (u64)br;
-  code_space[code_idx++] = (u64)begin_addr;
-  *(u64 *)while_placeholder = (u64)&code_space[code_idx];
+  ARENA *a = arena_check(spop(), "ARENA-RESET");
+  if (a)
+    a->used = 0;
 }
 
-void exit_word(WORD *w) {
+void arena_free_word(WORD *w) {
   UNUSED(w);
-  if (rsp == 0) {
-    ip = NULL;
+  if (sp < 1) {
+    printf("%s[ERROR] ARENA-FREE expects an arena%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
     return;
   }
-  ip = (u64 *)rstack[--rsp];
+  ARENA *a = arena_check(spop(), "ARENA-FREE");
+  if (!a)
+    return;
+  if (a->prev)
+    a->prev->next = a->next;
+  else
+    arenas = a->next;
+  if (a->next)
+    a->next->prev = a->prev;
+  a->magic = 0;
+  munmap(a, a->size + sizeof(ARENA));
+}
+
+void heap_stats(void) {
+  printf("[HEAP] SIZE | SLOTS | USED\n");
+  for (u64 c = 0; c < HEAP_CLASSES; c++)
+    printf("[POOL] %llu %llu %llu\n", heap_class_size(c), heap_pools[c].slots,
+           heap_pools[c].used);
+  printf("[LARGE] %llu blocks, %llu bytes\n", heap_large_count,
+         heap_large_bytes);
+  for (ARENA *a = arenas; a; a = a->next)
+    printf("[ARENA] %llu size %llu used %llu peak %llu\n", (u64)a, a->size,
+           a->used, a->peak);
+}
+
+void bye(WORD *w) {
+  UNUSED(w);
+  save_buffers_at_exit();
+  exit(EXIT_SUCCESS);
+}
+
+// : (compile mode)
+void colon(WORD *ww) {
+  UNUSED(ww);
+  if (cfsp != 0) {
+    printf("%s[ERROR] Unresolved control structure\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    exit(EXIT_FAILURE);
+  }
+
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  if (len == 0) {
+    printf("%s[ERROR] Expected word name after ':'\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+
+  dict_mark_take();
+  char *name = intern_string(addr, len);
+
+  if (!name) {
+    printf("%s[ERROR] Expected word name after ':'\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  WORD *nw = &dictionary[here++];
+  nw->name = name;
+  nw->code = NULL;
+  nw->continuation = &code_space[code_idx];
+  nw->flags = 0;
+  nw->op = OP_DOCOL;
+  dict_index_insert(nw);
+  current_def = nw;
+  f_mode = COMPILE;
+}
+// Peephole optimizer, run by ; over the definition it closes.
+//
+//   LIT a LIT b op  -> LIT (a op b)      constant folding (constvar words
+//                                        count as literals)
+//   LIT n +         -> (LIT+) n          LIT n - becomes (LIT+) -n
+//   dup @           -> (DUP@)
+//   over +          -> (OVER+)
+//   0= 0BRANCH t    -> (0=0BRANCH) t
+//   name ;          -> (TAIL) name ;     when name is a colon word
+//
+// The body is rewritten in place; it only ever shrinks, except for the tail
+// call. Nothing is fused across a branch target. The free code space right
+// after the definition holds the old -> new offset map used to patch the
+// branches (bit 0 marks a branch target).
+int is_literal(WORD *w) { return w->op == OP_LIT || w->op == OP_PUSHVAL; }
+
+u64 literal_at(u64 *body, u64 start) {
+  WORD *w = (WORD *)body[start];
+  return w->op == OP_LIT ? body[start + 1] : *w->data;
+}
+
+int fold_binary(WORD *w, u64 a, u64 b, u64 *res) {
+  if (w->op == OP_ADD)
+    *res = a + b;
+  else if (w->op == OP_SUB)
+    *res = a - b;
+  else if (w->op == OP_MUL)
+    *res = a * b;
+  else if (w->code == and_word)
+    *res = a & b;
+  else if (w->code == or_word)
+    *res = a | b;
+  else if (w->code == lshift_word)
+    *res = a << b;
+  else if (w->code == rshift_word)
+    *res = a >> b;
+  else
+    return 0;
+  return 1;
+}
+
+void optimize_definition(WORD *def) {
+  u64 *body = def->continuation;
+  u64 n = (u64)(&code_space[code_idx] - body);
+
+  if (!ensure_code(2 + n + 1))
+    return;
+  u64 *map = &code_space[code_idx + 2];
+  memset(map, 0, (n + 1) * CELLSIZE);
+
+  // mark branch targets, leave the definition alone if it isn't plain code
+  for (u64 x = 0; x < n;) {
+    WORD *cw = (WORD *)body[x];
+    if (cw < dictionary || cw >= dictionary + here)
+      return;
+    OPERAND kind = word_operand(cw);
+    if (kind == OPERAND_NONE) {
+      x += 1;
+      continue;
+    }
+    if (x + 1 >= n)
+      return;
+    if (kind == OPERAND_CODE) {
+      u64 *target = (u64 *)body[x + 1];
+      if (target < body || target > body + n)
+        return;
+      map[target - body] = 1;
+    }
+    x += 2;
+  }
+
+  u64 hist[3]; // starts of the last instructions emitted since a target
+  u64 nhist = 0;
+  u64 last = n; // start of the last instruction emitted
+  u64 out = 0;
+  u64 res;
+
+#define DROP_OUT(k)                                                            \
+  do {                                                                         \
+    out = hist[nhist - (k)];                                                   \
+    nhist -= (k);                                                              \
+  } while (0)
+#define EMIT_OUT(w, has_arg, a)                                                \
+  do {                                                                         \
+    if (nhist == 3) {                                                          \
+      hist[0] = hist[1];                                                       \
+      hist[1] = hist[2];                                                       \
+      nhist = 2;                                                               \
+    }                                                                          \
+    hist[nhist++] = out;                                                       \
+    last = out;                                                                \
+    body[out++] = (u64)(w);                                                    \
+    if (has_arg)                                                               \
+      body[out++] = (a);                                                       \
+  } while (0)
+
+  for (u64 in = 0; in < n;) {
+    WORD *cw = (WORD *)body[in];
+    OPERAND kind = word_operand(cw);
+    u64 arg = kind != OPERAND_NONE ? body[in + 1] : 0;
+
+    if (map[in] & 1)
+      nhist = 0;
+    map[in] |= out << 1;
+    in += kind != OPERAND_NONE ? 2 : 1;
+
+    WORD *p1 = nhist >= 1 ? (WORD *)body[hist[nhist - 1]] : NULL;
+    WORD *p2 = nhist >= 2 ? (WORD *)body[hist[nhist - 2]] : NULL;
+
+    if (p2 && is_literal(p1) && is_literal(p2) &&
+        fold_binary(cw, literal_at(body, hist[nhist - 2]),
+                    literal_at(body, hist[nhist - 1]), &res)) {
+      DROP_OUT(2);
+      EMIT_OUT(word_lit, 1, res);
+    } else if (p1 && is_literal(p1) &&
+               (cw->op == OP_ADD || cw->op == OP_SUB)) {
+      u64 v = literal_at(body, hist[nhist - 1]);
+      if (cw->op == OP_SUB)
+        v = -v;
+      DROP_OUT(1);
+      if (nhist && (WORD *)body[hist[nhist - 1]] == word_lit_add)
+        body[hist[nhist - 1] + 1] += v;
+      else
+        EMIT_OUT(word_lit_add, 1, v);
+    } else if (p1 && p1->op == OP_DUP && cw->op == OP_FETCH) {
+      DROP_OUT(1);
+      EMIT_OUT(word_dup_fetch, 0, 0);
+    } else if (p1 && p1->op == OP_OVER && cw->op == OP_ADD) {
+      DROP_OUT(1);
+      EMIT_OUT(word_over_add, 0, 0);
+    } else if (p1 && p1->op == OP_EQZ && cw->op == OP_ZBRANCH) {
+      DROP_OUT(1);
+      EMIT_OUT(word_zeq_branch, 1, arg);
+    } else {
+      EMIT_OUT(cw, kind != OPERAND_NONE, arg);
+    }
+  }
+#undef DROP_OUT
+#undef EMIT_OUT
+
+  // tail call
+  if (last + 1 == out && ((WORD *)body[last])->op == OP_DOCOL) {
+    body[out] = body[last];
+    body[last] = (u64)word_tail;
+    out += 1;
+  }
+  map[n] |= out << 1;
+
+  for (u64 x = 0; x < out;) {
+    WORD *cw = (WORD *)body[x];
+    OPERAND kind = word_operand(cw);
+    if (kind == OPERAND_CODE) {
+      u64 old = (u64 *)body[x + 1] - body;
+      body[x + 1] = (u64)(body + (map[old] >> 1));
+    }
+    x += kind != OPERAND_NONE ? 2 : 1;
+  }
+
+  memset(map, 0, (n + 1) * CELLSIZE);
+  code_idx = (u64)(body - code_space) + out;
+}
+
+// JIT memory
+//
+// Machine code (native words, CODE words and the fragments EXEC-CODE runs)
+// has a region of its own, apart from code space and blob space, which hold
+// only threaded code and strings and are not executable. The region is one
+// memfd mapped twice: code is written through jit_rw and runs from jit_rx,
+// so no page is writable and executable at once. jit_x() turns a write
+// address into its run address. Without memfd_create both are one RWX
+// mapping.
+//
+// The first JIT_FRAGMENTS * JIT_FRAGMENT_LEN bytes are the EXEC-CODE cache
+// (see exec_code). The rest is handed out in order to words by jit_alloc and
+// given back by FORGET, like code space. Pages are backed when first written.
+#define JIT_RESERVE (1ull << 30)
+#define JIT_FRAGMENTS 4096 // power of 2
+#define JIT_FRAGMENT_LEN 16
+
+unsigned char *jit_rw = NULL;
+unsigned char *jit_rx = NULL;
+u64 jit_p = JIT_FRAGMENTS * JIT_FRAGMENT_LEN; // next free byte for words
+
+void jit_init(void) {
+  int fd = memfd_create("skforth-jit", MFD_CLOEXEC);
+  if (fd != -1 && ftruncate(fd, JIT_RESERVE) == 0) {
+    jit_rw = mmap(NULL, JIT_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    jit_rx = mmap(NULL, JIT_RESERVE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+  }
+  if (fd != -1)
+    close(fd);
+  if (jit_rw && jit_rw != MAP_FAILED && jit_rx && jit_rx != MAP_FAILED)
+    return;
+  if (jit_rw && jit_rw != MAP_FAILED)
+    munmap(jit_rw, JIT_RESERVE);
+  if (jit_rx && jit_rx != MAP_FAILED)
+    munmap(jit_rx, JIT_RESERVE);
+
+  jit_rw = mmap(NULL, JIT_RESERVE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (jit_rw == MAP_FAILED) {
+    printf("%s[ERROR] MMAP failed to reserve %llu BYTES in virtual memory "
+           "for JIT code\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, JIT_RESERVE, strerror(errno), RESETALLSTYLES);
+    exit(EXIT_FAILURE);
+  }
+  jit_rx = jit_rw;
+}
+
+unsigned char *jit_x(unsigned char *p) { return p - jit_rw + jit_rx; }
+
+// write address for bytes of code at jit_p, NULL if the region is full
+unsigned char *jit_alloc(u64 bytes) {
+  if (jit_p + bytes > JIT_RESERVE)
+    return NULL;
+  return jit_rw + jit_p;
+}
+
+// done writing code from p to end: claim it and make it visible to the
+// run view
+void jit_commit(unsigned char *p, unsigned char *end) {
+  __builtin___clear_cache((char *)jit_x(p), (char *)jit_x(end));
+  jit_p += ((u64)(end - p) + 15) & ~15ull;
+}
+
+// Native backend (x86-64)
+//
+// With NATIVE-ON, ; translates the finished threaded body of a definition
+// into machine code in JIT memory (see above). The word then
+// becomes a primitive whose code pointer is the native function, so both
+// inner interpreters call it like any other C primitive. The threaded body
+// is kept in ->data for see and for images (which fall back to it).
+//
+// Register use inside native bodies:
+//   rbx  top of stack (valid when sp > 0)
+//   r12  stack base
+//   r13  sp (depth, the top of stack is not stored in memory)
+// stack[0 .. sp-2] live in memory, so a push/pop only touches the cell under
+// the top. stack[-1] is a slack cell (see main) so that works with sp == 0.
+//
+// Each native word has a C ABI entry of NATIVE_WRAPPER_LEN bytes that loads
+// the registers from stack/sp, calls the body and stores them back. Native
+// words call each other's bodies directly and keep the registers. Any other
+// word is called through C (spilling the top of stack and sp first): its code
+// pointer for primitives, execute() for colon words.
+//
+// Native code does no stack depth checks, the guard pages around the stacks
+// catch it running off one.
+#define NATIVE_WRAPPER_LEN 64
+#define NATIVE_MAX_CELLS 4096
+
+u64 native_mode = 0;
+
+#if defined(__x86_64__)
+unsigned char *native_p = NULL;
+u64 native_map[NATIVE_MAX_CELLS + 1];   // threaded cell -> native offset
+u64 native_fixup[NATIVE_MAX_CELLS];     // rel32 to patch
+u64 native_fixup_to[NATIVE_MAX_CELLS];  // threaded cell it jumps to
+
+// stack cell operands: [r12 + r13*8 - 8 * n]
+#define NAT_TOP1 "\xEC\xF8"
+#define NAT_TOP2 "\xEC\xF0"
+#define NAT_TOP3 "\xEC\xE8"
+
+void nat_emit(const char *bytes, u64 len) {
+  memcpy(native_p, bytes, len);
+  native_p += len;
+}
+#define NAT(s) nat_emit(s, sizeof(s) - 1)
+
+void nat_imm64(u64 v) {
+  memcpy(native_p, &v, CELLSIZE);
+  native_p += CELLSIZE;
+}
+
+// target is a run address (see jit_x)
+void nat_rel32(unsigned char *target) {
+  int rel = (int)(target - (jit_x(native_p) + 4));
+  memcpy(native_p, &rel, 4);
+  native_p += 4;
+}
+
+void nat_spill(void) {
+  NAT("\x4B\x89\x5C" NAT_TOP1);          // mov [top1], rbx
+  NAT("\x48\xB8");                       // mov rax, &sp
+  nat_imm64((u64)&sp);
+  NAT("\x4C\x89\x28");                   // mov [rax], r13
+}
+
+void nat_reload(void) {
+  NAT("\x48\xB8");                       // mov rax, &sp
+  nat_imm64((u64)&sp);
+  NAT("\x4C\x8B\x28");                   // mov r13, [rax]
+  NAT("\x4B\x8B\x5C" NAT_TOP1);          // mov rbx, [top1]
+}
+
+// push rax
+void nat_push_rax(void) {
+  NAT("\x4B\x89\x5C" NAT_TOP1);          // mov [top1], rbx
+  NAT("\x49\xFF\xC5");                   // inc r13
+  NAT("\x48\x89\xC3");                   // mov rbx, rax
+}
+
+// pop into rax (old top), rbx gets the new top
+void nat_pop_rax(void) {
+  NAT("\x48\x89\xD8");                   // mov rax, rbx
+  NAT("\x49\xFF\xCD");                   // dec r13
+  NAT("\x4B\x8B\x5C" NAT_TOP1);          // mov rbx, [top1]
+}
+
+// a b -- flag
+void nat_compare(const char *setcc) {
+  NAT("\x49\xFF\xCD");                   // dec r13
+  NAT("\x4B\x8B\x44" NAT_TOP1);          // mov rax, [top1]
+  NAT("\x48\x39\xD8");                   // cmp rax, rbx
+  nat_emit(setcc, 3);                    // setcc al
+  NAT("\x0F\xB6\xD8");                   // movzx ebx, al
+}
+
+void nat_call_c(void (*fn)(WORD *), WORD *arg) {
+  nat_spill();
+  NAT("\x48\xBF");                       // mov rdi, arg
+  nat_imm64((u64)arg);
+  NAT("\x48\xB8");                       // mov rax, fn
+  nat_imm64((u64)fn);
+  NAT("\xFF\xD0");                       // call rax
+  nat_reload();
+}
+
+// C ABI entry and exit: save the registers above and load them from
+// stack/sp, then store them back and return
+void nat_enter(void) {
+  NAT("\x53\x41\x54\x41\x55");           // push rbx; push r12; push r13
+  NAT("\x49\xBC");                       // mov r12, stack
+  nat_imm64((u64)stack);
+  nat_reload();
+}
+
+void nat_leave(void) {
+  nat_spill();
+  NAT("\x41\x5D\x41\x5C\x5B\xC3");       // pop r13; pop r12; pop rbx; ret
+}
+
+void nat_branch(u64 ncells, const char *jcc, u64 jcc_len, u64 to) {
+  nat_emit(jcc, jcc_len);
+  native_fixup[ncells] = (u64)native_p;
+  native_fixup_to[ncells] = to;
+  native_p += 4;
+}
+
+int native_compile(WORD *def) {
+  // called after ; appended the terminator
+  u64 *body = def->continuation;
+  u64 n = (u64)(&code_space[code_idx - 1] - body);
+  if (n > NATIVE_MAX_CELLS)
+    return 0;
+  // worst case is a bit under 64 bytes per cell
+  unsigned char *entry = jit_alloc(n * 64 + NATIVE_WRAPPER_LEN + 64);
+  if (!entry)
+    return 0;
+  unsigned char *start = entry + NATIVE_WRAPPER_LEN;
+  u64 nfix = 0;
+
+  // C ABI wrapper
+  native_p = entry;
+  nat_enter();
+  NAT("\xE8");                           // call body
+  nat_rel32(jit_x(start));
+  nat_leave();
+  while (native_p < start)
+    NAT("\xCC");
+
+  NAT("\x48\x83\xEC\x08");               // sub rsp, 8 (align calls)
+  for (u64 x = 0; x <= n;) {
+    native_map[x] = (u64)(native_p - entry);
+    if (x == n) {
+      NAT("\x48\x83\xC4\x08\xC3");       // add rsp, 8; ret
+      break;
+    }
+    WORD *cw = (WORD *)body[x];
+    if (cw < dictionary || cw >= dictionary + here)
+      return 0;
+    OPERAND kind = word_operand(cw);
+    u64 arg = kind != OPERAND_NONE ? body[x + 1] : 0;
+    x += kind != OPERAND_NONE ? 2 : 1;
+
+    switch (cw->op) {
+    case OP_LIT:
+      NAT("\x48\xB8");                   // mov rax, n
+      nat_imm64(arg);
+      nat_push_rax();
+      break;
+    case OP_ZBRANCH:
+    case OP_ZEQBRANCH:
+      nat_pop_rax();
+      NAT("\x48\x85\xC0");               // test rax, rax
+      if (cw->op == OP_ZBRANCH)
+        nat_branch(nfix++, "\x0F\x84", 2, (u64 *)arg - body); // jz
+      else
+        nat_branch(nfix++, "\x0F\x85", 2, (u64 *)arg - body); // jnz
+      break;
+    case OP_BRANCH:
+      nat_branch(nfix++, "\xE9", 1, (u64 *)arg - body);       // jmp
+      break;
+    case OP_EXIT:
+      NAT("\x48\x83\xC4\x08\xC3");       // add rsp, 8; ret
+      break;
+    case OP_PUSHVAL:
+    case OP_PUSHPTR:
+      NAT("\x48\xB8");                   // mov rax, cw
+      nat_imm64((u64)cw);
+      NAT("\x48\x8B\x40");               // mov rax, [rax + data]
+      *native_p++ = (unsigned char)__builtin_offsetof(WORD, data);
+      if (cw->op == OP_PUSHVAL)
+        NAT("\x48\x8B\x00");             // mov rax, [rax]
+      nat_push_rax();
+      break;
+    case OP_ADD:
+      NAT("\x49\xFF\xCD");               // dec r13
+      NAT("\x4B\x03\x5C" NAT_TOP1);      // add rbx, [top1]
+      break;
+    case OP_SUB:
+      NAT("\x49\xFF\xCD");               // dec r13
+      NAT("\x4B\x8B\x44" NAT_TOP1);      // mov rax, [top1]
+      NAT("\x48\x29\xD8");               // sub rax, rbx
+      NAT("\x48\x89\xC3");               // mov rbx, rax
+      break;
+    case OP_MUL:
+      NAT("\x49\xFF\xCD");               // dec r13
+      NAT("\x4B\x0F\xAF\x5C" NAT_TOP1);  // imul rbx, [top1]
+      break;
+    case OP_DEC:
+      NAT("\x48\xFF\xCB");               // dec rbx
+      break;
+    case OP_DUP:
+      NAT("\x4B\x89\x5C" NAT_TOP1);      // mov [top1], rbx
+      NAT("\x49\xFF\xC5");               // inc r13
+      break;
+    case OP_DROP:
+      NAT("\x49\xFF\xCD");               // dec r13
+      NAT("\x4B\x8B\x5C" NAT_TOP1);      // mov rbx, [top1]
+      break;
+    case OP_SWAP:
+      NAT("\x4B\x8B\x44" NAT_TOP2);      // mov rax, [top2]
+      NAT("\x4B\x89\x5C" NAT_TOP2);      // mov [top2], rbx
+      NAT("\x48\x89\xC3");               // mov rbx, rax
+      break;
+    case OP_OVER:
+      NAT("\x4B\x8B\x44" NAT_TOP2);      // mov rax, [top2]
+      nat_push_rax();
+      break;
+    case OP_ROT:
+      // ( a b c -- c a b )
+      NAT("\x4B\x8B\x44" NAT_TOP3);      // mov rax, [top3]
+      NAT("\x4B\x8B\x4C" NAT_TOP2);      // mov rcx, [top2]
+      NAT("\x4B\x89\x5C" NAT_TOP3);      // mov [top3], rbx
+      NAT("\x4B\x89\x44" NAT_TOP2);      // mov [top2], rax
+      NAT("\x48\x89\xCB");               // mov rbx, rcx
+      break;
+    case OP_EQZ:
+      NAT("\x48\x85\xDB");               // test rbx, rbx
+      NAT("\x0F\x94\xC0");               // sete al
+      NAT("\x0F\xB6\xD8");               // movzx ebx, al
+      break;
+    case OP_EQ:
+      nat_compare("\x0F\x94\xC0");       // sete al
+      break;
+    case OP_LT:
+      nat_compare("\x0F\x92\xC0");       // setb al
+      break;
+    case OP_GT:
+      nat_compare("\x0F\x97\xC0");       // seta al
+      break;
+    case OP_FETCH:
+      NAT("\x48\x8B\x1B");               // mov rbx, [rbx]
+      break;
+    case OP_STORE:
+      NAT("\x4B\x8B\x44" NAT_TOP2);      // mov rax, [top2]
+      NAT("\x48\x89\x03");               // mov [rbx], rax
+      NAT("\x49\x83\xED\x02");           // sub r13, 2
+      NAT("\x4B\x8B\x5C" NAT_TOP1);      // mov rbx, [top1]
+      break;
+    case OP_LITADD:
+      NAT("\x48\xB8");                   // mov rax, n
+      nat_imm64(arg);
+      NAT("\x48\x01\xC3");               // add rbx, rax
+      break;
+    case OP_DUPFETCH:
+      NAT("\x4B\x89\x5C" NAT_TOP1);      // mov [top1], rbx
+      NAT("\x49\xFF\xC5");               // inc r13
+      NAT("\x48\x8B\x1B");               // mov rbx, [rbx]
+      break;
+    case OP_OVERADD:
+      NAT("\x4B\x03\x5C" NAT_TOP2);      // add rbx, [top2]
+      break;
+    case OP_DO:
+    case OP_QDO:
+      NAT("\x48\x89\xDE");               // mov rsi, rbx (index)
+      NAT("\x4B\x8B\x7C" NAT_TOP2);      // mov rdi, [top2] (limit)
+      NAT("\x49\x83\xED\x02");           // sub r13, 2
+      NAT("\x4B\x8B\x5C" NAT_TOP1);      // mov rbx, [top1]
+      if (cw->op == OP_QDO) {
+        NAT("\x48\x39\xFE");             // cmp rsi, rdi
+        nat_branch(nfix++, "\x0F\x84", 2, (u64 *)arg - body); // je
+      }
+      NAT("\x48\xB8");                   // mov rax, loop_enter
+      nat_imm64((u64)loop_enter);
+      NAT("\xFF\xD0");                   // call rax
+      break;
+    case OP_LOOP:
+    case OP_PLUSLOOP:
+      if (cw->op == OP_LOOP) {
+        NAT("\xBF\x01\x00\x00\x00");     // mov edi, 1
+      } else {
+        NAT("\x48\x89\xDF");             // mov rdi, rbx
+        NAT("\x49\xFF\xCD");             // dec r13
+        NAT("\x4B\x8B\x5C" NAT_TOP1);    // mov rbx, [top1]
+      }
+      NAT("\x48\xB8");                   // mov rax, loop_step
+      nat_imm64((u64)loop_step);
+      NAT("\xFF\xD0");                   // call rax
+      NAT("\x85\xC0");                   // test eax, eax
+      nat_branch(nfix++, "\x0F\x85", 2, (u64 *)arg - body); // jnz
+      break;
+    case OP_LEAVE:
+      NAT("\x48\xB8");                   // mov rax, &rsp
+      nat_imm64((u64)&rsp);
+      NAT("\x48\x83\x28\x02");           // sub qword [rax], 2
+      nat_branch(nfix++, "\xE9", 1, (u64 *)arg - body);       // jmp
+      break;
+    case OP_I:
+      NAT("\x48\xB8");                   // mov rax, &rsp
+      nat_imm64((u64)&rsp);
+      NAT("\x48\x8B\x00");               // mov rax, [rax]
+      NAT("\x48\xB9");                   // mov rcx, rstack
+      nat_imm64((u64)rstack);
+      NAT("\x48\x8B\x44\xC1\xF8");       // mov rax, [rcx + rax*8 - 8]
+      nat_push_rax();
+      break;
+    case OP_TAIL:
+    case OP_DOCOL: {
+      WORD *callee = cw->op == OP_TAIL ? (WORD *)arg : cw;
+      unsigned char *target =
+          callee == def ? jit_x(start)
+          : callee->flags & NATIVE
+              ? (unsigned char *)callee->code + NATIVE_WRAPPER_LEN
+              : NULL;
+      if (target && cw->op == OP_TAIL) {
+        NAT("\x48\x83\xC4\x08\xE9");     // add rsp, 8; jmp body
+        nat_rel32(target);
+      } else if (target) {
+        NAT("\xE8");                     // call body
+        nat_rel32(target);
+      } else {
+        nat_call_c(execute, callee);
+        if (cw->op == OP_TAIL)
+          NAT("\x48\x83\xC4\x08\xC3");   // add rsp, 8; ret
+      }
+      break;
+    }
+    default:
+      // operands of any other word are unknown to the backend
+      if (kind != OPERAND_NONE)
+        return 0;
+      if (cw->code)
+        nat_call_c(cw->code, cw);
+      else
+        nat_call_c(execute, cw);
+      break;
+    }
+  }
+
+  for (u64 x = 0; x < nfix; x += 1) {
+    unsigned char *at = (unsigned char *)native_fixup[x];
+    int rel = (int)(native_map[native_fixup_to[x]] - (at + 4 - entry));
+    memcpy(at, &rel, 4);
+  }
+
+  jit_commit(entry, native_p);
+
+  def->data = def->continuation;
+  def->continuation = NULL;
+  def->code = (void (*)(WORD *))jit_x(entry);
+  def->op = OP_CALL;
+  def->flags |= NATIVE;
+  return 1;
+}
+#else
+int native_compile(WORD *def) {
+  UNUSED(def);
+  return 0;
+}
+#endif
+
+void native_on_word(WORD *w) {
+  UNUSED(w);
+#if defined(__x86_64__)
+  native_mode = 1;
+#else
+  printf("%s[ERROR] No native backend for this architecture\n%s", SETREDCOLOR,
+         RESETALLSTYLES);
+#endif
+}
+
+void native_off_word(WORD *w) {
+  UNUSED(w);
+  native_mode = 0;
+}
+
+// Compile to C
+//
+// COMPILE-C name translates the threaded body of a colon word into one C
+// function, builds it with the system gcc into a shared object, dlopen()s it
+// and makes the function the word's code. The data stack stays in memory
+// (stack/sp) as for every primitive, the inline opcodes become plain C and
+// anything else is called through its code pointer or execute(), so gcc gets
+// to optimize the whole body at once. Like the native backend it does no
+// stack checks.
+//
+// The source holds no address of this process: the words it refers to are
+// read from the table in the word's ->refs, and skforth_bind() only hands
+// over the stacks and execute(), which are the same for every word. The
+// same definition therefore always gives the same text, and the objects are
+// cached as $HOME/.config/skforth/cc/<hash>.so keyed by an FNV hash of it.
+// Words whose bodies translate alike share one object, each with its own
+// table.
+// The threaded body is kept in ->data for SEE and images, which run it
+// instead.
+
+static const char cc_prelude[] =
+    "typedef unsigned long long u64;\n"
+    "typedef long long i64;\n"
+    "static u64 **STK, *SP, **RSTK, *RSP;\n"
+    "static void (*EXECUTE)(void *);\n"
+    "#define CODE(i) (*(void (**)(void *))((char *)W[i] + %llu))\n"
+    "#define DATA(i) (*(u64 **)((char *)W[i] + %llu))\n"
+    "void skforth_bind(u64 **stk, u64 *sp, u64 **rstk, u64 *rsp,\n"
+    "                  void (*ex)(void *)) {\n"
+    "  STK = stk;\n"
+    "  SP = sp;\n"
+    "  RSTK = rstk;\n"
+    "  RSP = rsp;\n"
+    "  EXECUTE = ex;\n"
+    "}\n"
+    "static int step(u64 n) {\n"
+    "  u64 *R = *RSTK, r = *RSP;\n"
+    "  i64 o = (i64)(R[r - 1] - R[r - 2]);\n"
+    "  i64 next = (i64)((u64)o + n);\n"
+    "  R[r - 1] += n;\n"
+    "  if (((o ^ next) & (o ^ (i64)n)) < 0) {\n"
+    "    *RSP = r - 2;\n"
+    "    return 0;\n"
+    "  }\n"
+    "  return 1;\n"
+    "}\n"
+    "void skforth_word(void *self) {\n"
+    "  void **W = *(void ***)((char *)self + %llu);\n"
+    "  u64 *S = *STK, *R = *RSTK, d = *SP, t;\n"
+    "  (void)W;\n"
+    "  (void)R;\n"
+    "  (void)t;\n";
+
+typedef void (*CC_BIND)(u64 **, u64 *, u64 **, u64 *, void (*)(void *));
+
+u64 cc_ref(WORD **refs, u64 *nrefs, WORD *w) {
+  for (u64 x = 0; x < *nrefs; x += 1)
+    if (refs[x] == w)
+      return x;
+  refs[*nrefs] = w;
+  return (*nrefs)++;
+}
+
+// writes the C translation of body[0..n) to f, 0 when a cell has no
+// translation
+int cc_translate(FILE *f, WORD *def, u64 *body, u64 n, WORD **refs,
+                 u64 *nrefs) {
+  u_int8_t *target = calloc(n + 1, 1);
+  if (!target)
+    return 0;
+  for (u64 x = 0; x < n;) {
+    WORD *cw = (WORD *)body[x];
+    if (word_operand(cw) == OPERAND_CODE)
+      target[(u64 *)body[x + 1] - body] = 1;
+    x += word_operand(cw) != OPERAND_NONE ? 2 : 1;
+  }
+
+  fprintf(f, cc_prelude, (unsigned long long)offsetof(WORD, code),
+          (unsigned long long)offsetof(WORD, data),
+          (unsigned long long)offsetof(WORD, refs));
+  fprintf(f, "c0:;\n");
+
+  int ok = 1;
+  for (u64 x = 0; x < n && ok;) {
+    WORD *cw = (WORD *)body[x];
+    OPERAND kind = word_operand(cw);
+    u64 arg = kind != OPERAND_NONE ? body[x + 1] : 0;
+    u64 to = kind == OPERAND_CODE ? (u64)((u64 *)arg - body) : 0;
+
+    if (x && target[x])
+      fprintf(f, "c%llu:;\n", x);
+    x += kind != OPERAND_NONE ? 2 : 1;
+
+    switch (cw->op) {
+    case OP_LIT:
+      fprintf(f, "  S[d++] = %lluull;\n", arg);
+      break;
+    case OP_ZBRANCH:
+      fprintf(f, "  if (!S[--d])\n    goto c%llu;\n", to);
+      break;
+    case OP_ZEQBRANCH:
+      fprintf(f, "  if (S[--d])\n    goto c%llu;\n", to);
+      break;
+    case OP_BRANCH:
+      fprintf(f, "  goto c%llu;\n", to);
+      break;
+    case OP_EXIT:
+      fprintf(f, "  goto done;\n");
+      break;
+    case OP_PUSHVAL:
+      fprintf(f, "  S[d++] = *DATA(%llu);\n", cc_ref(refs, nrefs, cw));
+      break;
+    case OP_PUSHPTR:
+      fprintf(f, "  S[d++] = (u64)DATA(%llu);\n", cc_ref(refs, nrefs, cw));
+      break;
+    case OP_ADD:
+      fprintf(f, "  S[d - 2] += S[d - 1];\n  d--;\n");
+      break;
+    case OP_SUB:
+      fprintf(f, "  S[d - 2] -= S[d - 1];\n  d--;\n");
+      break;
+    case OP_MUL:
+      fprintf(f, "  S[d - 2] *= S[d - 1];\n  d--;\n");
+      break;
+    case OP_DEC:
+      fprintf(f, "  S[d - 1]--;\n");
+      break;
+    case OP_DUP:
+      fprintf(f, "  S[d] = S[d - 1];\n  d++;\n");
+      break;
+    case OP_DROP:
+      fprintf(f, "  d--;\n");
+      break;
+    case OP_SWAP:
+      fprintf(f, "  t = S[d - 1];\n  S[d - 1] = S[d - 2];\n  S[d - 2] = t;\n");
+      break;
+    case OP_OVER:
+      fprintf(f, "  S[d] = S[d - 2];\n  d++;\n");
+      break;
+    case OP_ROT: // ( a b c -- c a b )
+      fprintf(f, "  t = S[d - 1];\n  S[d - 1] = S[d - 2];\n"
+                 "  S[d - 2] = S[d - 3];\n  S[d - 3] = t;\n");
+      break;
+    case OP_EQZ:
+      fprintf(f, "  S[d - 1] = S[d - 1] == 0;\n");
+      break;
+    case OP_EQ:
+      fprintf(f, "  S[d - 2] = S[d - 2] == S[d - 1];\n  d--;\n");
+      break;
+    case OP_LT:
+      fprintf(f, "  S[d - 2] = S[d - 2] < S[d - 1];\n  d--;\n");
+      break;
+    case OP_GT:
+      fprintf(f, "  S[d - 2] = S[d - 2] > S[d - 1];\n  d--;\n");
+      break;
+    case OP_FETCH:
+      fprintf(f, "  S[d - 1] = *(u64 *)S[d - 1];\n");
+      break;
+    case OP_STORE: // ( val addr -- )
+      fprintf(f, "  *(u64 *)S[d - 1] = S[d - 2];\n  d -= 2;\n");
+      break;
+    case OP_TOR:
+      fprintf(f, "  R[(*RSP)++] = S[--d];\n");
+      break;
+    case OP_FROMR:
+      fprintf(f, "  S[d++] = R[--(*RSP)];\n");
+      break;
+    case OP_LITADD:
+      fprintf(f, "  S[d - 1] += %lluull;\n", arg);
+      break;
+    case OP_DUPFETCH:
+      fprintf(f, "  S[d] = *(u64 *)S[d - 1];\n  d++;\n");
+      break;
+    case OP_OVERADD:
+      fprintf(f, "  S[d - 1] += S[d - 2];\n");
+      break;
+    case OP_DO:
+    case OP_QDO:
+      // limit is second, index on top
+      fprintf(f, "  d -= 2;\n");
+      if (cw->op == OP_QDO)
+        fprintf(f, "  if (S[d] == S[d + 1])\n    goto c%llu;\n", to);
+      fprintf(f, "  R[(*RSP)++] = S[d];\n  R[(*RSP)++] = S[d + 1];\n");
+      break;
+    case OP_LOOP:
+      fprintf(f, "  if (step(1))\n    goto c%llu;\n", to);
+      break;
+    case OP_PLUSLOOP:
+      fprintf(f, "  if (step(S[--d]))\n    goto c%llu;\n", to);
+      break;
+    case OP_LEAVE:
+      fprintf(f, "  *RSP -= 2;\n  goto c%llu;\n", to);
+      break;
+    case OP_I:
+      fprintf(f, "  S[d++] = R[*RSP - 1];\n");
+      break;
+    case OP_TAIL:
+    case OP_DOCOL: {
+      WORD *callee = cw->op == OP_TAIL ? (WORD *)arg : cw;
+      if (callee == def && cw->op == OP_TAIL) {
+        fprintf(f, "  goto c0;\n");
+        break;
+      }
+      if (callee == def)
+        fprintf(f, "  *SP = d;\n  skforth_word(self);\n  d = *SP;\n");
+      else
+        fprintf(f, "  *SP = d;\n  EXECUTE(W[%llu]);\n  d = *SP;\n",
+                cc_ref(refs, nrefs, callee));
+      if (cw->op == OP_TAIL)
+        fprintf(f, "  goto done;\n");
+      break;
+    }
+    default:
+      // operands of any other word are unknown to the translation
+      if (kind != OPERAND_NONE) {
+        printf("%s[ERROR] COMPILE-C can't translate %s\n%s", SETREDCOLOR,
+               cw->name, RESETALLSTYLES);
+        ok = 0;
+        break;
+      }
+      fprintf(f, "  *SP = d;\n");
+      if (cw->code)
+        fprintf(f, "  CODE(%llu)(W[%llu]);\n", cc_ref(refs, nrefs, cw),
+                cc_ref(refs, nrefs, cw));
+      else
+        fprintf(f, "  EXECUTE(W[%llu]);\n", cc_ref(refs, nrefs, cw));
+      fprintf(f, "  d = *SP;\n");
+      break;
+    }
+  }
+
+  if (target[n])
+    fprintf(f, "c%llu:;\n", n);
+  fprintf(f, "done:\n  *SP = d;\n}\n");
+  free(target);
+  return ok;
+}
+
+u64 cc_hash(const char *p, u64 len) {
+  u64 h = 14695981039346656037ULL;
+  for (u64 x = 0; x < len; x += 1)
+    h = (h ^ (u_int8_t)p[x]) * 1099511628211ULL;
+  return h;
+}
+
+// runs gcc on c_path without a shell, so no path is ever parsed as shell text
+int cc_build(char *c_path, char *so_path) {
+  char *argv[] = {"gcc", "-O2", "-shared", "-fPIC", "-o", so_path, c_path,
+                  NULL};
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  if (pid == -1 || waitpid(pid, &status, 0) != pid)
+    return 0;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// loads $HOME/.config/skforth/cc/<hash>.so, building it from src first when
+// it isn't there yet
+void *cc_load(const char *src, u64 len) {
+  char dir[256], c_path[300], so_path[300], tmp_path[300];
+  u64 hash = cc_hash(src, len);
+
+  snprintf(dir, sizeof(dir), "%s/.config/skforth/cc", getenv("HOME"));
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    printf("%s[ERROR] Could not create %s\n%s", SETREDCOLOR, dir,
+           RESETALLSTYLES);
+    return NULL;
+  }
+  snprintf(so_path, sizeof(so_path), "%s/%016llx.so", dir, hash);
+
+  if (access(so_path, R_OK) != 0) {
+    snprintf(c_path, sizeof(c_path), "%s/%016llx.c", dir, hash);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%016llx.so.%d", dir, hash,
+             (int)getpid());
+    FILE *f = fopen(c_path, "w");
+    if (!f || fwrite(src, 1, len, f) != len) {
+      if (f)
+        fclose(f);
+      printf("%s[ERROR] Could not write %s\n%s", SETREDCOLOR, c_path,
+             RESETALLSTYLES);
+      return NULL;
+    }
+    fclose(f);
+    // built under a temporary name so a half written object is never loaded
+    if (!cc_build(c_path, tmp_path) || rename(tmp_path, so_path) != 0) {
+      unlink(tmp_path);
+      printf("%s[ERROR] gcc failed on %s\n%s", SETREDCOLOR, c_path,
+             RESETALLSTYLES);
+      return NULL;
+    }
+  }
+
+  void *handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle)
+    printf("%s[ERROR] %s\n%s", SETREDCOLOR, dlerror(), RESETALLSTYLES);
+  return handle;
+}
+
+// threaded (TAIL) w cells jump straight into w's continuation, which is gone
+// once w is compiled; they become a plain call followed by EXIT
+void cc_untail(WORD *w) {
+  for (u64 x = 0; x < here; x += 1) {
+    u64 *p = dictionary[x].continuation;
+    if (dictionary[x].op != OP_DOCOL || !p)
+      continue;
+    while (*p) {
+      WORD *cw = (WORD *)*p;
+      if (cw < dictionary || cw >= dictionary + here)
+        break;
+      if (cw == word_tail && (WORD *)p[1] == w) {
+        p[0] = (u64)w;
+        p[1] = (u64)word_exit;
+      }
+      p += word_operand(cw) != OPERAND_NONE ? 2 : 1;
+    }
+  }
+}
+
+// COMPILE-C name
+void compile_c_word(WORD *w) {
+  UNUSED(w);
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  if (len == 0) {
+    printf("%s[ERROR] Expected word name after COMPILE-C\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+
+  WORD *def = find_word(addr, len);
+  if (!def) {
+    printf("%s[ERROR] Unknown word to compile: %.*s\n%s", SETREDCOLOR,
+           (int)len, addr, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (def->op != OP_DOCOL || !def->continuation || def == current_def) {
+    printf("%s[ERROR] %s is not a finished colon definition\n%s",
+           SETREDCOLOR, def->name, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+
+  // the body ends at the 0 cell ; leaves behind
+  u64 *body = def->continuation;
+  u64 n = 0;
+  while (body[n]) {
+    WORD *cw = (WORD *)body[n];
+    if (cw < dictionary || cw >= dictionary + here) {
+      printf("%s[ERROR] %s is not plain threaded code\n%s", SETREDCOLOR,
+             def->name, RESETALLSTYLES);
+      print_source_line();
+      return;
+    }
+    n += word_operand(cw) != OPERAND_NONE ? 2 : 1;
+  }
+
+  // every cell refers to at most one word
+  WORD **refs = malloc((n + 1) * sizeof(WORD *));
+  char *src = NULL;
+  size_t src_len = 0;
+  FILE *f = open_memstream(&src, &src_len);
+  u64 nrefs = 0;
+  if (!refs || !f) {
+    if (f)
+      fclose(f);
+    free(src);
+    free(refs);
+    printf("%s[ERROR] Out of memory\n%s", SETREDCOLOR, RESETALLSTYLES);
+    return;
+  }
+  int ok = cc_translate(f, def, body, n, refs, &nrefs);
+  refs[nrefs] = NULL;
+  fclose(f);
+
+  void *handle = ok ? cc_load(src, src_len) : NULL;
+  free(src);
+  CC_BIND bind = handle ? (CC_BIND)dlsym(handle, "skforth_bind") : NULL;
+  void *fn = handle ? dlsym(handle, "skforth_word") : NULL;
+  if (!bind || !fn) {
+    if (handle) {
+      printf("%s[ERROR] %s\n%s", SETREDCOLOR, dlerror(), RESETALLSTYLES);
+      dlclose(handle);
+    }
+    free(refs);
+    print_source_line();
+    return;
+  }
+  // the object and its table stay for the life of the process. Binding
+  // again when dlopen() handed back an object already in use is harmless
+  bind(&stack, &sp, &rstack, &rsp, (void (*)(void *))execute);
+  def->refs = refs;
+
+  def->data = def->continuation;
+  def->continuation = NULL;
+  def->code = (void (*)(WORD *))fn;
+  def->op = OP_CALL;
+  def->flags |= COMPILED_C;
+  cc_untail(def);
+}
+
+// ;(end compile mode)
+void semicolon(WORD *w) {
+  UNUSED(w);
+#if PEEPHOLE
+  if (current_def && cfsp == 0)
+    optimize_definition(current_def);
+#endif
+  emit_code((u64)NULL);
+  if (native_mode && current_def && cfsp == 0)
+    native_compile(current_def);
+  f_mode = INTERPRET;
+  current_def = NULL;
+}
+// if\else\then branching
+void zero_branch(WORD *w) {
+  UNUSED(w);
+  u64 flag = spop();
+  // conditional argument
+  u64 target = *ip++;
+  if (flag == 0)
+    ip = (u64 *)target;
+}
+void branch(WORD *w) {
+  UNUSED(w);
+  u64 target = *ip++;
+  ip = (u64 *)target;
+}
+// (LIT+) n  <=>  LIT n +
+void lit_add(WORD *w) {
+  UNUSED(w);
+  u64 n = *ip++;
+  if (sp == 0) {
+    printf("%s[ERROR] Stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  stack[sp - 1] += n;
+}
+// (DUP@)  <=>  dup @
+void dup_fetch(WORD *w) {
+  UNUSED(w);
+  if (sp == 0) {
+    printf("%s[ERROR] Stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush(*(u64 *)stack[sp - 1]);
+}
+// (OVER+)  <=>  over +
+void over_add(WORD *w) {
+  UNUSED(w);
+  if (sp < 2) {
+    printf("%s[ERROR] Stack is too small\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  stack[sp - 1] += stack[sp - 2];
+}
+// (0=0BRANCH) target  <=>  0= 0BRANCH target
+void zero_equals_branch(WORD *w) {
+  UNUSED(w);
+  u64 flag = spop();
+  u64 target = *ip++;
+  if (flag != 0)
+    ip = (u64 *)target;
+}
+// (TAIL) name: jump into name's body reusing the caller's return address
+void tail_call(WORD *w) {
+  UNUSED(w);
+  WORD *target = (WORD *)*ip++;
+  ip = target->continuation;
+}
+// counted loops. (DO) moves limit and index to the return stack, index on
+// top, where I, J, (LOOP) and (+LOOP) find them
+void loop_enter(u64 limit, u64 index) {
+  rstack[rsp++] = limit;
+  rstack[rsp++] = index;
+}
+// adds n to the index, 1 to loop again, 0 (loop params dropped) once the
+// index crossed the boundary between limit-1 and limit
+int loop_step(u64 n) {
+  i64 o = (i64)(rstack[rsp - 1] - rstack[rsp - 2]);
+  i64 next = (i64)((u64)o + n);
+  rstack[rsp - 1] += n;
+  if (((o ^ next) & (o ^ (i64)n)) < 0) {
+    rsp -= 2;
+    return 0;
+  }
+  return 1;
+}
+int loop_params_ok(u64 cells, const char *name) {
+  if (CHECKED(rsp < cells)) {
+    printf("%s[ERROR] %s outside a DO loop\n%s", SETREDCOLOR, name,
+           RESETALLSTYLES);
+    print_source_line();
+    return 0;
+  }
+  return -1;
+}
+void do_runtime(WORD *w) {
+  UNUSED(w);
+  if (CHECKED(sp < 2)) {
+    printf("%s[ERROR] DO expects limit index\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (CHECKED(rsp + 2 > STACK_SIZE)) {
+    printf("%s[ERROR] Return stack overflow\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 index = spop();
+  u64 limit = spop();
+  loop_enter(limit, index);
+}
+// (?DO) target: like (DO) but skips the loop when limit == index
+void qdo_runtime(WORD *w) {
+  UNUSED(w);
+  u64 target = *ip++;
+  if (CHECKED(sp < 2)) {
+    printf("%s[ERROR] ?DO expects limit index\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (CHECKED(rsp + 2 > STACK_SIZE)) {
+    printf("%s[ERROR] Return stack overflow\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 index = spop();
+  u64 limit = spop();
+  if (index == limit)
+    ip = (u64 *)target;
+  else
+    loop_enter(limit, index);
+}
+// (LOOP) target  <=>  1 (+LOOP) target
+void loop_runtime(WORD *w) {
+  UNUSED(w);
+  u64 target = *ip++;
+  if (loop_params_ok(2, "LOOP") && loop_step(1))
+    ip = (u64 *)target;
+}
+void plus_loop_runtime(WORD *w) {
+  UNUSED(w);
+  u64 target = *ip++;
+  if (CHECKED(sp == 0)) {
+    printf("%s[ERROR] Stack is empty\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 n = spop();
+  if (loop_params_ok(2, "+LOOP") && loop_step(n))
+    ip = (u64 *)target;
+}
+// (LEAVE) target: drop the loop params and jump past the loop
+void leave_runtime(WORD *w) {
+  UNUSED(w);
+  u64 target = *ip++;
+  if (!loop_params_ok(2, "LEAVE"))
+    return;
+  rsp -= 2;
+  ip = (u64 *)target;
+}
+void i_word(WORD *w) {
+  UNUSED(w);
+  if (loop_params_ok(2, "I"))
+    spush(rstack[rsp - 1]);
+}
+void j_word(WORD *w) {
+  UNUSED(w);
+  if (loop_params_ok(4, "J"))
+    spush(rstack[rsp - 3]);
+}
+void unloop_word(WORD *w) {
+  UNUSED(w);
+  if (loop_params_ok(2, "UNLOOP"))
+    rsp -= 2;
+}
+void if_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] IF only valid in compile mode\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  emit_code((u64)word_zbranch);
+  emit_code(0);
+  CFPUSH(&code_space[code_idx - 1]);
+}
+void else_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] ELSE only valid in compile mode\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  emit_code((u64)word_branch);
+  emit_code(0);
+  u64 *if_placeholder = CFPOP();
+  *if_placeholder = (u64)&code_space[code_idx];
+  CFPUSH(&code_space[code_idx - 1]);
+}
+void then_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] THEN only valid in compile mode\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 *placeholder = CFPOP();
+  *placeholder = (u64)&code_space[code_idx];
+}
+// begin\while\repeat branching
+void begin(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] BEGIN is only valid in compile mode\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  CFPUSH(&code_space[code_idx]);
+}
+void while_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] WHILE is only valid in compile mode\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  emit_code((u64)word_zbranch);
+  emit_code(0);
+  CFPUSH(&code_space[code_idx - 1]);
+}
+
+void repeat(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] REPEAT is only valid in compile mode\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 *while_placeholder = CFPOP();
+  u64 *begin_addr = CFPOP();
+  emit_code((u64)word_branch);
+  emit_code((u64)begin_addr);
+  *(u64 *)while_placeholder = (u64)&code_space[code_idx];
+}
+
+// do\loop counted loops. DO saves the enclosing loop's LEAVE chain and the
+// loop start on the control flow stack. Every LEAVE (and ?DO) operand links
+// to the previous one until LOOP patches the whole chain to point past it
+u64 *leave_chain = NULL;
+u64 loop_depth = 0;
+
+void loop_begin(WORD *runtime, const char *name) {
+  if (f_mode != COMPILE) {
+    printf("%s[ERROR] %s is only valid in compile mode\n%s", SETREDCOLOR,
+           name, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  CFPUSH(leave_chain);
+  leave_chain = NULL;
+  emit_code((u64)runtime);
+  if (word_operand(runtime) == OPERAND_CODE) {
+    emit_code(0);
+    leave_chain = &code_space[code_idx - 1];
+  }
+  CFPUSH(&code_space[code_idx]);
+  loop_depth++;
+}
+void loop_end(WORD *runtime, const char *name) {
+  if (f_mode != COMPILE || loop_depth == 0) {
+    printf("%s[ERROR] %s without DO\n%s", SETREDCOLOR, name, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 *start = CFPOP();
+  emit_code((u64)runtime);
+  emit_code((u64)start);
+  while (leave_chain) {
+    u64 *next = (u64 *)*leave_chain;
+    *leave_chain = (u64)&code_space[code_idx];
+    leave_chain = next;
+  }
+  leave_chain = CFPOP();
+  loop_depth--;
+}
+void do_word(WORD *w) {
+  UNUSED(w);
+  loop_begin(word_do, "DO");
+}
+void qdo_word(WORD *w) {
+  UNUSED(w);
+  loop_begin(word_qdo, "?DO");
+}
+void loop_word(WORD *w) {
+  UNUSED(w);
+  loop_end(word_loop, "LOOP");
+}
+void plus_loop_word(WORD *w) {
+  UNUSED(w);
+  loop_end(word_plus_loop, "+LOOP");
+}
+void leave_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode != COMPILE || loop_depth == 0) {
+    printf("%s[ERROR] LEAVE outside a DO loop\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  emit_code((u64)word_leave);
+  emit_code((u64)leave_chain);
+  leave_chain = &code_space[code_idx - 1];
+}
+
+void exit_word(WORD *w) {
+  UNUSED(w);
+  if (rsp == 0) {
+    ip = NULL;
+    return;
+  }
+  ip = (u64 *)rstack[--rsp];
 }
 
 void main_interpret_line(char *line);
 
-void include_forth_file(WORD *w) {
-  UNUSED(w);
+void include_forth_file(WORD *w) {
+  UNUSED(w);
+
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  if (len == 0) {
+    printf("%s[ERROR] INCLUDE expects a name\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  char *fname = transient_string(addr, len);
+
+  if (!fname) {
+    printf("%s[ERROR] INCLUDE expects filename\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  FILE *f = fopen(fname, "r");
+  if (!f) {
+    printf("%s[ERROR] Could not open %s\n%s", SETREDCOLOR, fname,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    main_interpret_line(line);
+  }
+  fclose(f);
+  printf("%sDONE\n%s", SETGREENCOLOR, RESETALLSTYLES);
+}
+
+void interpret(WORD *ww) {
+  UNUSED(ww);
+  f_mode = INTERPRET;
+}
+
+void comptime(WORD *ww) {
+  UNUSED(ww);
+  f_mode = COMPILE;
+}
+
+void mode_show(WORD *ww) {
+  UNUSED(ww);
+  if (f_mode == INTERPRET)
+    printf("INTERPRET\n");
+  else
+    printf("COMPILE\n");
+}
+
+void mode_get(WORD *ww) {
+  UNUSED(ww);
+  if (sp >= (u64)STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush((u64)f_mode);
+}
+
+char *input_cursor_global = NULL;
+char *next_token(char **cursor);
+
+void interpret_token_word(WORD *ww) {
+  UNUSED(ww);
+
+  if (sp < 2) {
+    printf("%s[ERROR] INTERPRET-TOKEN expects addr len\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+
+  u64 len = spop();
+  char *addr = (char *)spop();
+
+  WORD *w = find_word(addr, len);
+
+  if (block_recording)
+    block_recording_note(w);
+
+  if (w) {
+    if (f_mode == INTERPRET) {
+      execute(w);
+    } else {
+      if (w->flags & IMMEDIATE)
+        execute(w);
+      else
+        emit_code((u64)w);
+    }
+  } else {
+    char tmp[64];
+    char *end;
+
+    if (sizeof(tmp) < len) {
+      printf("%sToken to long: %.*s\n%s", SETREDCOLOR, (int)len, addr,
+             RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
+
+    memcpy(tmp, addr, len);
+    tmp[len] = '\0';
+    u64 n = strtoull(tmp, &end, num_base);
+    if (*end == '\0') {
+      if (f_mode == INTERPRET)
+        spush(n);
+      else {
+        emit_code((u64)word_lit);
+        emit_code(n);
+      }
+
+    } else {
+      printf("%sUnknown word: %.*s\n%s", SETREDCOLOR, (int)len, addr,
+             RESETALLSTYLES);
+      print_source_line();
+      if (block_recording)
+        block_recording->tainted = 1;
+      return;
+    }
+  }
+}
+
+int c_next_token(char **addr, u64 *len) {
+retrypoint:
+  while (input_index < current_line_length &&
+         isspace((unsigned char)current_line_buffer[input_index]))
+    input_index++;
+
+  if (input_index >= current_line_length)
+    return 0;
+
+  if (current_line_buffer[input_index] == '\\') {
+    input_index = current_line_length;
+    return 0;
+  }
+
+  if (current_line_buffer[input_index] == '(') {
+    input_index++;
+    while (input_index < current_line_length &&
+           current_line_buffer[input_index] != ')')
+      input_index++;
+
+    if (input_index < current_line_length &&
+        current_line_buffer[input_index] == ')')
+      input_index++;
+
+    goto retrypoint;
+  }
+
+  char *start = current_line_buffer + input_index;
+
+  while (input_index < current_line_length &&
+         !isspace((unsigned char)current_line_buffer[input_index]))
+    input_index++;
+
+  *addr = start;
+  *len = (current_line_buffer + input_index) - start;
+  return 1;
+}
+
+void parse_name_word(WORD *w) {
+  UNUSED(w);
+
+  char *src = current_line_buffer;
+  u64 len_src = current_line_length;
+  u64 i = input_index;
+
+  while (i < len_src && isspace((unsigned char)src[i]))
+    i++;
+
+  if (i >= len_src) {
+    spush(0);
+    spush(0);
+    input_index = i;
+    return;
+  }
+
+  char *start = src + i;
+
+  while (i < len_src && !isspace((unsigned char)src[i]))
+    i++;
+
+  input_index = i;
+  spush((u64)start);
+  spush((u64)(src + i - start));
+}
+
+void parse_string_word(WORD *w) {
+  UNUSED(w);
+
+  char *src = current_line_buffer;
+  u64 len_src = current_line_length;
+  u64 i = input_index;
+
+  while (i < len_src && isspace((unsigned char)src[i]))
+    i++;
+
+  if (i >= len_src) {
+    spush(0);
+    spush(0);
+    input_index = i;
+    return;
+  }
+
+  char *start = src + i;
+
+  while (i < len_src && (unsigned char)src[i] != '"')
+    i++;
+
+  input_index = i + 1;
+  spush((u64)start);
+  spush((u64)(src + i - start));
+}
+
+// s" ( "string" -- addr len ) gives a transient copy when interpreting. When
+// compiling, the string is saved in blob space and compiled as two literals.
+void s_quote_word(WORD *w) {
+  UNUSED(w);
+  parse_string_word(NULL);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  if (f_mode == COMPILE) {
+    char *s = save_string(addr, len);
+    if (!ensure_code(4)) {
+      printf("%s[ERROR] Code space is full%s", SETREDCOLOR, RESETALLSTYLES);
+      print_source_line();
+      return;
+    }
+    emit_code((u64)word_lit);
+    emit_code((u64)s);
+    emit_code((u64)word_lit);
+    emit_code(len);
+    return;
+  }
+  spush((u64)transient_string(addr, len));
+  spush(len);
+}
+
+// BLOB-MARK ( -- u ) and BLOB-RELEASE ( u -- ) give back the blob space used
+// since the mark. Nothing may still point into it: BLOB-RELEASE refuses if a
+// word name, or any cell of code space or data space, does.
+void blob_mark_word(WORD *w) {
+  UNUSED(w);
+  spush(bytes_p);
+}
+
+int blob_referenced(const u64 *cells, u64 n, u64 lo, u64 hi) {
+  for (u64 x = 0; x < n; x++) {
+    if (cells[x] >= lo && cells[x] < hi)
+      return 1;
+  }
+  return 0;
+}
+
+// machine code holds addresses as imm64 operands at any byte offset
+int blob_referenced_bytes(const unsigned char *p, u64 n, u64 lo, u64 hi) {
+  for (u64 x = 0; x + CELLSIZE <= n; x++) {
+    u64 v;
+    memcpy(&v, p + x, CELLSIZE);
+    if (v >= lo && v < hi)
+      return 1;
+  }
+  return 0;
+}
+
+void blob_release_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] BLOB-RELEASE expects a mark%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 mark = spop();
+  if (mark > bytes_p) {
+    printf("%s[ERROR] BLOB-RELEASE: %llu is past BLOB-LEN%s", SETREDCOLOR,
+           mark, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 lo = (u64)bytes_space + mark;
+  u64 hi = (u64)bytes_space + bytes_p;
+  // native and COMPILE-C words keep their threaded body in code space, so
+  // the literals baked into their machine code are found there. CODE words
+  // only have JIT memory; the EXEC-CODE fragments before it are a cache
+  u64 words_jit = JIT_FRAGMENTS * JIT_FRAGMENT_LEN;
+  int used = blob_referenced(code_space, code_idx, lo, hi) ||
+             blob_referenced(data_space, dp, lo, hi) ||
+             blob_referenced_bytes(jit_rw + words_jit, jit_p - words_jit, lo,
+                                   hi) ||
+             blob_referenced_bytes(code_buf, code_buf_len, lo, hi);
+  for (u64 x = 0; x < here && !used; x++) {
+    WORD *dw = &dictionary[x];
+    used = (u64)dw->name >= lo && (u64)dw->name < hi;
+    for (u64 y = 0; (dw->flags & COMPILED_C) && dw->refs[y] && !used; y++)
+      used = (u64)dw->refs[y] >= lo && (u64)dw->refs[y] < hi;
+  }
+  if (used) {
+    printf("%s[ERROR] BLOB-RELEASE: blob space after the mark is still in "
+           "use%s",
+           SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  bytes_p = mark;
+  // hand whole pages back to the kernel
+  u64 keep = page_round(lo) - (u64)bytes_space;
+  if (keep < MAX_BYTES_SPACE)
+    madvise(bytes_space + keep, page_round(MAX_BYTES_SPACE) - keep,
+            MADV_DONTNEED);
+  intern_rebuild();
+}
+
+void stack_error(const char *what);
+
+void interpret_line_c_word(WORD *w) {
+  UNUSED(w);
+
+  u64 len;
+  char *addr;
+
+  while (c_next_token(&addr, &len)) {
+
+    if (len == 0)
+      break;
+
+    spush((u64)addr);
+    spush(len);
+    interpret_token_word(NULL);
+#if !STACK_CHECKS
+    // an unchecked pop of an empty stack lands on the slack cells below
+    // stack[0] and wraps sp instead of faulting. Pushes fault at
+    // stack[STACK_SIZE], the first byte of the upper guard page
+    if (sp > STACK_SIZE)
+      stack_error("underflow");
+#endif
+  }
+}
+
+void system_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode == COMPILE) {
+    emit_code((u64)word_shell_cmd);
+    return;
+  }
+  if (sp < 2) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 len = spop();
+  char *start = (char *)spop();
+  char *command = transient_string(start, len);
+  system(command);
+}
+
+void blocks_base_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush((u64)blocks_base);
+}
+void block_size_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush(BLOCK_SIZE);
+}
+
+// Block buffers
+//
+// BLOCK and BUFFER hand out one of NUM_BUFFERS in-memory buffers instead of
+// an address inside the BLOCKS.blk mapping. When all of them are assigned,
+// the least recently used one is reused. UPDATE marks the buffer handed out
+// last as dirty, and only dirty buffers are ever written back: when they are
+// reused, by SAVE-BUFFERS and by FLUSH. Writing back copies the buffer into
+// the MAP_SHARED mapping and msyncs just the pages it covers. SAVE-BUFFERS
+// writes in block order and merges neighbouring page ranges into one msync.
+#define NO_BLOCK ((u64)-1)
+
+typedef struct block_buffer {
+  u64 block;    // NO_BLOCK when unassigned
+  u64 last_use; // buffer_clock at the last BLOCK/BUFFER, 0 when unassigned
+  int dirty;
+} BLOCK_BUFFER;
+
+BLOCK_BUFFER *block_buffers = NULL;
+BLOCK_BUFFER **flush_order = NULL;
+
+typedef struct flush_range {
+  u64 start; // byte offsets into the block store
+  u64 end;
+} FLUSH_RANGE;
+
+FLUSH_RANGE *flush_ranges = NULL;
+u_int8_t *block_buffer_space = NULL;
+BLOCK_BUFFER *current_buffer = NULL;
+u64 buffer_clock = 0;
+
+u_int8_t *buffer_data(BLOCK_BUFFER *b) {
+  return block_buffer_space + (b - block_buffers) * BLOCK_SIZE;
+}
+
+// msync [off, off + len) of the block store
+int sync_block_range(u64 off, u64 len) {
+  u64 start = off & ~((u64)sysconf(_SC_PAGESIZE) - 1);
+  if (msync(blocks_base + start, off + len - start, MS_SYNC) == -1) {
+    printf("%s[ERROR] Could not write BLOCKS to disk\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, strerror(errno), RESETALLSTYLES);
+    return 0;
+  }
+  return 1;
+}
+
+int save_buffer(BLOCK_BUFFER *b) {
+  block_index_stale();
+  memcpy(blocks_base + b->block * BLOCK_SIZE, buffer_data(b), BLOCK_SIZE);
+  b->dirty = 0;
+  return sync_block_range(b->block * BLOCK_SIZE, BLOCK_SIZE);
+}
+
+int buffer_cmp(const void *a, const void *b) {
+  u64 x = (*(BLOCK_BUFFER *const *)a)->block;
+  u64 y = (*(BLOCK_BUFFER *const *)b)->block;
+  return (x > y) - (x < y);
+}
+
+// Copies the dirty buffers into the mapping in block order and collects the
+// page ranges they cover into flush_ranges, merging neighbours. Returns the
+// number of ranges.
+u64 write_back_dirty(void) {
+  u64 n = 0;
+  for (u64 i = 0; i < NUM_BUFFERS; i++) {
+    if (block_buffers[i].dirty)
+      flush_order[n++] = &block_buffers[i];
+  }
+  qsort(flush_order, n, sizeof(*flush_order), buffer_cmp);
+
+  u64 page = (u64)sysconf(_SC_PAGESIZE);
+  u64 nranges = 0;
+  for (u64 i = 0; i < n; i++) {
+    BLOCK_BUFFER *b = flush_order[i];
+    u64 off = b->block * BLOCK_SIZE;
+    block_index_stale();
+    memcpy(blocks_base + off, buffer_data(b), BLOCK_SIZE);
+    b->dirty = 0;
+
+    u64 first = off & ~(page - 1);
+    if (nranges == 0 || first > flush_ranges[nranges - 1].end)
+      flush_ranges[nranges++].start = first;
+    flush_ranges[nranges - 1].end = off + BLOCK_SIZE;
+  }
+  return nranges;
+}
+
+int save_all_buffers(void) {
+  u64 n = write_back_dirty();
+  int ok = 1;
+  for (u64 i = 0; i < n; i++)
+    ok &= sync_block_range(flush_ranges[i].start,
+                           flush_ranges[i].end - flush_ranges[i].start);
+  return ok;
+}
+
+// bye and the end of input write the UPDATEd buffers back, as the MAP_SHARED
+// stores did before there were buffers
+void save_buffers_at_exit(void) {
+  if (block_buffers && blocks_base)
+    save_all_buffers();
+}
+
+void empty_buffers(void) {
+  for (u64 i = 0; i < NUM_BUFFERS; i++) {
+    block_buffers[i].block = NO_BLOCK;
+    block_buffers[i].last_use = 0;
+    block_buffers[i].dirty = 0;
+  }
+  current_buffer = NULL;
+}
+
+// Returns the buffer assigned to `blk`, assigning one if needed. `read`
+// fills a newly assigned buffer from the block store (BLOCK) or leaves its
+// contents as they are (BUFFER).
+BLOCK_BUFFER *assign_buffer(u64 blk, int read) {
+  if (!block_buffers) {
+    printf("%s[ERROR] BLOCKS are not available%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return NULL;
+  }
+  if (blk >= NUM_BLOCKS) {
+    printf("%s[ERROR] Invalid block index: %llu %s", SETREDCOLOR, blk,
+           RESETALLSTYLES);
+    print_source_line();
+    return NULL;
+  }
+
+  BLOCK_BUFFER *b = NULL;
+  for (u64 i = 0; i < NUM_BUFFERS && !b; i++) {
+    if (block_buffers[i].block == blk)
+      b = &block_buffers[i];
+  }
+  if (!b) {
+    b = &block_buffers[0];
+    for (u64 i = 1; i < NUM_BUFFERS; i++) {
+      if (block_buffers[i].last_use < b->last_use)
+        b = &block_buffers[i];
+    }
+    if (b->dirty && !save_buffer(b))
+      return NULL;
+    b->block = blk;
+    if (read)
+      memcpy(buffer_data(b), blocks_base + blk * BLOCK_SIZE, BLOCK_SIZE);
+  }
+  b->last_use = ++buffer_clock;
+  current_buffer = b;
+  return b;
+}
+
+void block_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  BLOCK_BUFFER *b = assign_buffer(spop(), 1);
+  if (b)
+    spush((u64)buffer_data(b));
+}
+
+void buffer_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  BLOCK_BUFFER *b = assign_buffer(spop(), 0);
+  if (b)
+    spush((u64)buffer_data(b));
+}
+
+void update_word(WORD *w) {
+  UNUSED(w);
+  if (!current_buffer) {
+    printf("%s[ERROR] No block buffer to UPDATE%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  current_buffer->dirty = 1;
+  block_cache_drop(current_buffer->block);
+}
+
+void save_buffers_word(WORD *w) {
+  UNUSED(w);
+  if (block_buffers)
+    save_all_buffers();
+}
+
+void empty_buffers_word(WORD *w) {
+  UNUSED(w);
+  if (block_buffers)
+    empty_buffers();
+}
+
+void flush_word(WORD *w) {
+  UNUSED(w);
+  if (block_buffers && save_all_buffers())
+    empty_buffers();
+}
+
+// Background flushing
+//
+// FLUSH-ASYNC copies the dirty buffers into the mapping like FLUSH, then
+// hands their page ranges to a flusher thread instead of calling msync
+// itself. Each pass of the thread takes every range queued since the last
+// one, merges them and syncs each merged range once, so flushes issued while
+// it is busy are committed together. WAIT-FLUSH blocks until everything
+// queued so far is on disk and reports a failed msync.
+pthread_t flusher;
+int flusher_started = 0;
+pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t flush_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t flush_done = PTHREAD_COND_INITIALIZER;
+FLUSH_RANGE *flush_queue = NULL; // guarded by flush_lock
+u64 flush_queued = 0;
+u64 flush_queue_cap = 0;
+u64 flush_requested = 0; // FLUSH-ASYNC calls so far
+u64 flush_completed = 0; // of those, how many are on disk
+int flush_errno = 0;
+
+int range_cmp(const void *a, const void *b) {
+  u64 x = ((const FLUSH_RANGE *)a)->start;
+  u64 y = ((const FLUSH_RANGE *)b)->start;
+  return (x > y) - (x < y);
+}
+
+void *flusher_main(void *arg) {
+  UNUSED(arg);
+  FLUSH_RANGE *batch = NULL;
+  u64 batch_cap = 0;
+
+  pthread_mutex_lock(&flush_lock);
+  for (;;) {
+    while (flush_completed == flush_requested)
+      pthread_cond_wait(&flush_work, &flush_lock);
+
+    // swap queues so FLUSH-ASYNC can keep queueing while we sync
+    FLUSH_RANGE *q = flush_queue;
+    u64 q_cap = flush_queue_cap;
+    u64 n = flush_queued;
+    u64 target = flush_requested;
+    flush_queue = batch;
+    flush_queue_cap = batch_cap;
+    flush_queued = 0;
+    batch = q;
+    batch_cap = q_cap;
+    pthread_mutex_unlock(&flush_lock);
+
+    qsort(batch, n, sizeof(*batch), range_cmp);
+    int err = 0;
+    for (u64 i = 0; i < n;) {
+      u64 start = batch[i].start;
+      u64 end = batch[i].end;
+      for (i++; i < n && batch[i].start <= end; i++) {
+        if (batch[i].end > end)
+          end = batch[i].end;
+      }
+      if (msync(blocks_base + start, end - start, MS_SYNC) == -1)
+        err = errno;
+    }
+
+    pthread_mutex_lock(&flush_lock);
+    flush_completed = target;
+    if (err)
+      flush_errno = err;
+    pthread_cond_broadcast(&flush_done);
+  }
+  return NULL;
+}
+
+// Returns 0, or the errno of an msync that failed since the last call.
+int wait_flush(void) {
+  pthread_mutex_lock(&flush_lock);
+  while (flush_completed != flush_requested)
+    pthread_cond_wait(&flush_done, &flush_lock);
+  int err = flush_errno;
+  flush_errno = 0;
+  pthread_mutex_unlock(&flush_lock);
+  return err;
+}
+
+// Lets queued msyncs finish while the store is still mapped. main calls it
+// before its teardown, the atexit hook covers bye and the other exit()s
+void wait_flush_at_exit(void) {
+  if (!flusher_started)
+    return;
+  int err = wait_flush();
+  if (err)
+    printf("%s[ERROR] Could not write BLOCKS to disk\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, strerror(err), RESETALLSTYLES);
+}
+
+void flush_async_word(WORD *w) {
+  UNUSED(w);
+  if (!block_buffers)
+    return;
+  if (!flusher_started) {
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0) {
+      printf("%s[ERROR] Could not start the flusher thread, flushing "
+             "synchronously%s\n",
+             SETREDCOLOR, RESETALLSTYLES);
+      if (save_all_buffers())
+        empty_buffers();
+      return;
+    }
+    flusher_started = 1;
+    atexit(wait_flush_at_exit);
+  }
+
+  u64 n = write_back_dirty();
+  empty_buffers();
+
+  pthread_mutex_lock(&flush_lock);
+  if (flush_queued + n > flush_queue_cap) {
+    u64 cap = (flush_queued + n) * 2;
+    FLUSH_RANGE *q = realloc(flush_queue, cap * sizeof(FLUSH_RANGE));
+    if (!q) {
+      pthread_mutex_unlock(&flush_lock);
+      // the data is in the mapping already; sync it here instead
+      for (u64 i = 0; i < n; i++)
+        sync_block_range(flush_ranges[i].start,
+                         flush_ranges[i].end - flush_ranges[i].start);
+      return;
+    }
+    flush_queue = q;
+    flush_queue_cap = cap;
+  }
+  memcpy(flush_queue + flush_queued, flush_ranges, n * sizeof(FLUSH_RANGE));
+  flush_queued += n;
+  flush_requested++;
+  pthread_cond_signal(&flush_work);
+  pthread_mutex_unlock(&flush_lock);
+}
+
+void wait_flush_word(WORD *w) {
+  UNUSED(w);
+  int err = wait_flush();
+  if (err) {
+    printf("%s[ERROR] Could not write BLOCKS to disk\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, strerror(err), RESETALLSTYLES);
+    print_source_line();
+  }
+}
+
+void num_buffers_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush(NUM_BUFFERS);
+}
+
+void interpret_block_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 2) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 blk_len = spop();
+  char *base = (char *)spop();
+
+  char *p = base;
+  char *end = base + blk_len;
+
+  while (p < end) {
+    char *line_start = p;
+
+    while (p < end && *p != '\n')
+      p++;
+
+    char nl_saved = *p;
+    *p = '\0';
+
+    main_interpret_line(line_start);
+
+    *p = nl_saved;
+
+    if (p < end)
+      p++;
+  }
+}
+// Compiled-block cache
+//
+// LOAD hashes the block and remembers what loading it did, so loading the
+// same contents again can skip the tokenizer. Only blocks made of colon
+// definitions are cached: anything else run in interpret mode (numbers,
+// other words, errors) taints the LOAD, since its effects cannot be
+// replayed. An entry records the dictionary slots of the definitions, NUMBASE
+// before and after, and every word the block resolved by name that it did
+// not define itself.
+//
+// A replay is valid while each of those names still resolves to the same
+// word; otherwise parsing again could bind differently and the block is
+// parsed again. Replaying makes each definition the current one for its name
+// again, adding a copy of the dictionary entry only if something shadowed it
+// meanwhile. UPDATE and EDIT drop the entry of their block.
+typedef struct block_cache_entry {
+  u64 hash; // 0 when empty
+  u64 base_in;
+  u64 base_out;
+  u64 first; // dictionary index of the first definition
+  u64 count;
+  WORD **refs;
+  u64 nrefs;
+} BLOCK_CACHE_ENTRY;
+
+BLOCK_CACHE_ENTRY *block_cache = NULL;
+u64 block_cache_len = 0;
+
+void block_recording_note(WORD *w) {
+  BLOCK_RECORDING *r = block_recording;
+  if (f_mode == INTERPRET && (!w || (w->code != colon && w->code != immediate)))
+    r->tainted = 1;
+  if (!w || (u64)(w - dictionary) >= r->first)
+    return;
+  for (u64 x = 0; x < r->nrefs; x++) {
+    if (r->refs[x] == w)
+      return;
+  }
+  if (r->nrefs == r->refs_cap) {
+    r->refs_cap = r->refs_cap ? r->refs_cap * 2 : 16;
+    WORD **refs = realloc(r->refs, r->refs_cap * sizeof(WORD *));
+    if (!refs) {
+      r->tainted = 1;
+      return;
+    }
+    r->refs = refs;
+  }
+  r->refs[r->nrefs++] = w;
+}
+
+// FNV-1a style, a cell at a time
+u64 hash_block(const u_int8_t *p) {
+  u64 h = 14695981039346656037ULL;
+  u64 x = 0;
+  for (; x + CELLSIZE <= BLOCK_SIZE; x += CELLSIZE) {
+    u64 v;
+    memcpy(&v, p + x, CELLSIZE);
+    h = (h ^ v) * 1099511628211ULL;
+    h ^= h >> 29;
+  }
+  for (; x < BLOCK_SIZE; x++)
+    h = (h ^ p[x]) * 1099511628211ULL;
+  return h;
+}
+
+void block_cache_drop(u64 blk) {
+  if (blk >= block_cache_len)
+    return;
+  free(block_cache[blk].refs);
+  memset(&block_cache[blk], 0, sizeof(BLOCK_CACHE_ENTRY));
+}
+
+void block_cache_store(u64 blk, u64 hash, BLOCK_RECORDING *r, u64 base_in) {
+  if (blk >= block_cache_len) {
+    u64 len = NUM_BLOCKS > blk ? NUM_BLOCKS : blk + 1;
+    BLOCK_CACHE_ENTRY *c = realloc(block_cache, len * sizeof(*c));
+    if (!c) {
+      free(r->refs);
+      return;
+    }
+    memset(c + block_cache_len, 0, (len - block_cache_len) * sizeof(*c));
+    block_cache = c;
+    block_cache_len = len;
+  }
+  block_cache_drop(blk);
+  BLOCK_CACHE_ENTRY *e = &block_cache[blk];
+  e->hash = hash ? hash : 1;
+  e->base_in = base_in;
+  e->base_out = num_base;
+  e->first = r->first;
+  e->count = here - r->first;
+  e->refs = r->refs;
+  e->nrefs = r->nrefs;
+}
+
+int block_cache_replay(u64 blk, u64 hash) {
+  if (blk >= block_cache_len)
+    return 0;
+  BLOCK_CACHE_ENTRY *e = &block_cache[blk];
+  if (e->hash != (hash ? hash : 1) || e->base_in != num_base ||
+      e->first + e->count > here)
+    return 0;
+  for (u64 x = 0; x < e->nrefs; x++) {
+    if (find_word(e->refs[x]->name, strlen(e->refs[x]->name)) != e->refs[x])
+      return 0;
+  }
+  if (here + e->count > MAX_WORDS)
+    return 0;
+
+  for (u64 x = e->first; x < e->first + e->count; x++) {
+    WORD *d = &dictionary[x];
+    if (find_word(d->name, strlen(d->name)) == d)
+      continue;
+    dict_mark_take();
+    WORD *copy = &dictionary[here++];
+    *copy = *d;
+    dict_index_insert(copy);
+  }
+  num_base = e->base_out;
+  return 1;
+}
+
+// LOAD ( n -- )
+void load_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 blk = spop();
+  BLOCK_BUFFER *b = assign_buffer(blk, 1);
+  if (!b)
+    return;
+  u64 hash = hash_block(buffer_data(b));
+  if (block_cache_replay(blk, hash))
+    return;
+
+  // the block is interpreted line by line; resume the caller's line after
+  char *line = current_line_buffer;
+  u64 line_len = current_line_length;
+  u64 index = input_index;
+  u64 depth = sp;
+  u64 base_in = num_base;
+
+  BLOCK_RECORDING r = {0};
+  r.outer = block_recording;
+  r.first = here;
+  block_recording = &r;
+
+  curr_block_num = blk;
+  spush((u64)buffer_data(b));
+  spush(BLOCK_SIZE);
+  interpret_block_word(NULL);
+  curr_block_num = 0;
+
+  block_recording = r.outer;
+  current_line_buffer = line;
+  current_line_length = line_len;
+  input_index = index;
+
+  if (!r.tainted && f_mode == INTERPRET && cfsp == 0 && sp == depth)
+    block_cache_store(blk, hash, &r, base_in);
+  else {
+    block_cache_drop(blk);
+    free(r.refs);
+  }
+}
+
+void load_external_editor_buffer(WORD *w) {
+  if (sp < 2) {
+    UNUSED(w);
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 blk_len = spop();
+  char *base = (char *)spop();
+
+  // We close and reopen the file to force state re-synchronization.
+  // After an external editor (fork+exec via system()), the file descriptor
+  // state (offsets, cache associations) can become incoherent when mixing
+  // mmap and stdio I/O.
+  // Closing and reopening forces inode and page-cache revalidation.
+  //
+  //  NOTE: This is not a data sync issue (msync/fsync are insufficient here),
+  // but a file-descriptor state issue after external modification. I assume
+  close(tmp_block_editor_fd);
+  char line[256];
+  char *home = getenv("HOME");
+  if (home == NULL) {
+    fprintf(stderr, "%sError: HOME environment variable not found.%s\n",
+            SETREDCOLOR, RESETALLSTYLES);
+    exit(EXIT_FAILURE);
+  }
+  sprintf(line, "%s/.config/skforth/block_editor.fs", home);
+
+  tmp_block_editor_fd = open(line, O_RDWR);
+
+  lseek(tmp_block_editor_fd, 0, SEEK_SET);
+  ftruncate(tmp_block_editor_fd, BLOCK_SIZE);
+  int res = write(tmp_block_editor_fd, base, blk_len * sizeof(char));
+  if (res == -1) {
+    printf("%s[ERROR] Could not load BLOCK to tmp editor buffer%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+}
+void save_external_editor_buffer(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 blk_idx = spop();
+
+  // We close and reopen the file to force state re-synchronization.
+  // After an external editor (fork+exec via system()), the file descriptor
+  // state (offsets, cache associations) can become incoherent when mixing
+  // mmap and stdio I/O.
+  // Closing and reopening forces inode and page-cache revalidation.
+  //
+  //  NOTE: This is not a data sync issue (msync/fsync are insufficient here),
+  // but a file-descriptor state issue after external modification. I assume
+  close(tmp_block_editor_fd);
+  char line[256];
+  char *home = getenv("HOME");
+  if (home == NULL) {
+    fprintf(stderr, "%sError: HOME environment variable not found.%s\n",
+            SETREDCOLOR, RESETALLSTYLES);
+    exit(EXIT_FAILURE);
+  }
+  sprintf(line, "%s/.config/skforth/block_editor.fs", home);
+
+  tmp_block_editor_fd = open(line, O_RDWR);
+
+  // the edit lands in the block's buffer; UPDATE and FLUSH persist it
+  BLOCK_BUFFER *b = assign_buffer(blk_idx, 1);
+  if (!b)
+    return;
+  block_cache_drop(blk_idx);
+
+  lseek(tmp_block_editor_fd, 0, SEEK_SET);
+
+  int r = read(tmp_block_editor_fd, buffer_data(b), BLOCK_SIZE);
+  if (r == -1) {
+    printf("%s\n", strerror(errno));
+    printf("%s[ERROR] Could not load BLOCK to tmp editor buffer%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+}
+
+void blk_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+
+  spush(curr_block_num);
+}
+void blk_change_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 curr_blk = spop();
+  curr_block_num = curr_blk;
+}
+void num_blocks_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush(NUM_BLOCKS);
+}
+// MORE-BLOCKS ( n -- ) appends n blocks. The file grows with ftruncate, so
+// the new blocks are a hole and cost no disk space until written.
+void more_blocks_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 n = spop();
+  if (!blocks_base) {
+    printf("%s[ERROR] BLOCKS are not available%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 max_blocks = block_reserve / BLOCK_SIZE;
+  if (n > max_blocks - NUM_BLOCKS) {
+    printf("%s[ERROR] MORE-BLOCKS: only %llu more BLOCKS fit the reserved "
+           "range%s",
+           SETREDCOLOR, max_blocks - NUM_BLOCKS, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 total = NUM_BLOCKS + n;
+  wait_flush_word(NULL); // no msync in flight while the mapping changes
+  if (ftruncate(block_fd, total * BLOCK_SIZE) == -1 ||
+      mmap(blocks_base, total * BLOCK_SIZE, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_FIXED, block_fd, 0) == MAP_FAILED) {
+    printf("%s[ERROR] Could not grow BLOCKS.blk\n[SYS MSG] %s%s", SETREDCOLOR,
+           strerror(errno), RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  NUM_BLOCKS = total;
+}
+
+// Block search
+//
+// BLOCK-SEARCH ( addr len -- ) prints the block and offset of every match
+// of a string in the block store, i.e. BLOCKS.blk as mapped, without edits
+// that are still only in a buffer. Matches do not span blocks. On x86-64 it
+// compares the first and last byte of the string at 16 positions at a time
+// with SSE2 and only memcmps the candidates. Stores of SEARCH_SPLIT bytes or
+// more are split across up to SEARCH_THREADS threads.
+#define SEARCH_SPLIT (4ull << 20)
+#define SEARCH_THREADS 8
+
+typedef struct search_match {
+  u64 block;
+  u64 offset;
+} SEARCH_MATCH;
+
+typedef struct search_job {
+  u64 first; // blocks [first, last)
+  u64 last;
+  const char *needle;
+  u64 len;
+  SEARCH_MATCH *matches;
+  u64 n;
+  u64 cap;
+  int failed;
+} SEARCH_JOB;
+
+void search_add(SEARCH_JOB *j, u64 blk, u64 off) {
+  if (j->n == j->cap) {
+    u64 cap = j->cap ? j->cap * 2 : 64;
+    SEARCH_MATCH *m = realloc(j->matches, cap * sizeof(SEARCH_MATCH));
+    if (!m) {
+      j->failed = 1;
+      return;
+    }
+    j->matches = m;
+    j->cap = cap;
+  }
+  j->matches[j->n].block = blk;
+  j->matches[j->n].offset = off;
+  j->n++;
+}
+
+void search_block(SEARCH_JOB *j, u64 blk) {
+  const u_int8_t *p = blocks_base + blk * BLOCK_SIZE;
+  const char *needle = j->needle;
+  u64 len = j->len;
+  u64 last = BLOCK_SIZE - len; // last possible start
+  u64 x = 0;
+#if defined(__x86_64__)
+  __m128i first_byte = _mm_set1_epi8(needle[0]);
+  __m128i last_byte = _mm_set1_epi8(needle[len - 1]);
+  for (; x + 15 <= last; x += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(p + x));
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + x + len - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(a, first_byte), _mm_cmpeq_epi8(b, last_byte)));
+    while (mask) {
+      u64 at = x + __builtin_ctz(mask);
+      if (memcmp(p + at, needle, len) == 0)
+        search_add(j, blk, at);
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; x <= last; x++) {
+    if (p[x] == (u_int8_t)needle[0] && memcmp(p + x, needle, len) == 0)
+      search_add(j, blk, x);
+  }
+}
+
+void *search_main(void *arg) {
+  SEARCH_JOB *j = arg;
+  for (u64 blk = j->first; blk < j->last; blk++)
+    search_block(j, blk);
+  return NULL;
+}
+
+void block_search_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 2) {
+    printf("%s[ERROR] BLOCK-SEARCH expects addr len%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 len = spop();
+  const char *needle = (const char *)spop();
+  if (!blocks_base) {
+    printf("%s[ERROR] BLOCKS are not available%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (len == 0 || len > BLOCK_SIZE)
+    return;
+
+  u64 nthreads = 1;
+  if (NUM_BLOCKS * BLOCK_SIZE >= SEARCH_SPLIT) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = cpus > SEARCH_THREADS ? SEARCH_THREADS : (cpus < 1 ? 1 : cpus);
+    if (nthreads > NUM_BLOCKS)
+      nthreads = NUM_BLOCKS;
+  }
+
+  SEARCH_JOB jobs[SEARCH_THREADS] = {0};
+  pthread_t threads[SEARCH_THREADS];
+  u64 per = (NUM_BLOCKS + nthreads - 1) / nthreads;
+  for (u64 t = 0; t < nthreads; t++) {
+    jobs[t].first = t * per;
+    jobs[t].last = (t + 1) * per < NUM_BLOCKS ? (t + 1) * per : NUM_BLOCKS;
+    jobs[t].needle = needle;
+    jobs[t].len = len;
+  }
+  // job 0 runs on this thread; fall back to it for jobs without a thread
+  u64 started = 1;
+  for (; started < nthreads; started++) {
+    if (pthread_create(&threads[started], NULL, search_main, &jobs[started]))
+      break;
+  }
+  search_main(&jobs[0]);
+  for (u64 t = started; t < nthreads; t++)
+    search_main(&jobs[t]);
+
+  u64 total = 0;
+  for (u64 t = 0; t < nthreads; t++) {
+    if (t > 0 && t < started)
+      pthread_join(threads[t], NULL);
+    for (u64 m = 0; m < jobs[t].n; m++)
+      printf("BLOCK %llu OFFSET %llu\n", jobs[t].matches[m].block,
+             jobs[t].matches[m].offset);
+    total += jobs[t].n;
+    if (jobs[t].failed)
+      printf("%s[ERROR] Out of memory, some matches are missing%s\n",
+             SETREDCOLOR, RESETALLSTYLES);
+    free(jobs[t].matches);
+  }
+  printf("%llu matches\n", total);
+}
+
+// Definition index
+//
+// WHERE ( "name" -- ) prints the blocks that define name with `: name`. It
+// looks the name up in an index of all colon definitions in the store, kept
+// in BLOCKS.idx next to BLOCKS.blk as "name block" lines. The index is built
+// when WHERE finds no valid one, or by BLOCK-INDEX. Writing a buffer back to
+// the store deletes the file, so the next WHERE rebuilds it.
+typedef struct index_entry {
+  u64 name; // offset into block_index_names
+  u64 block;
+} INDEX_ENTRY;
+
+char block_index_path[256];
+INDEX_ENTRY *block_index = NULL;
+u64 block_index_len = 0;
+u64 block_index_cap = 0;
+char *block_index_names = NULL;
+u64 block_index_names_len = 0;
+u64 block_index_names_cap = 0;
+int block_index_valid = 0;
+// BLOCKS.idx may exist, at startup it can be one left by an earlier session
+int block_index_on_disk = 1;
+
+void block_index_stale(void) {
+  block_index_valid = 0;
+  block_index_len = 0;
+  block_index_names_len = 0;
+  if (block_index_on_disk) {
+    unlink(block_index_path);
+    block_index_on_disk = 0;
+  }
+}
+
+int block_index_add(const char *name, u64 len, u64 blk) {
+  if (block_index_len == block_index_cap) {
+    u64 cap = block_index_cap ? block_index_cap * 2 : 256;
+    INDEX_ENTRY *e = realloc(block_index, cap * sizeof(INDEX_ENTRY));
+    if (!e)
+      return 0;
+    block_index = e;
+    block_index_cap = cap;
+  }
+  if (block_index_names_len + len + 1 > block_index_names_cap) {
+    u64 cap = (block_index_names_len + len + 1) * 2;
+    char *n = realloc(block_index_names, cap);
+    if (!n)
+      return 0;
+    block_index_names = n;
+    block_index_names_cap = cap;
+  }
+  memcpy(block_index_names + block_index_names_len, name, len);
+  block_index_names[block_index_names_len + len] = '\0';
+  block_index[block_index_len].name = block_index_names_len;
+  block_index[block_index_len].block = blk;
+  block_index_len++;
+  block_index_names_len += len + 1;
+  return 1;
+}
+
+int block_char_blank(u_int8_t c) { return c == '\0' || isspace(c); }
+
+// Collects `: name` from every block, skipping \ and ( ) comments.
+int block_index_build(void) {
+  block_index_len = 0;
+  block_index_names_len = 0;
+  for (u64 blk = 0; blk < NUM_BLOCKS; blk++) {
+    const u_int8_t *p = blocks_base + blk * BLOCK_SIZE;
+    const u_int8_t *end = p + BLOCK_SIZE;
+    int want_name = 0;
+    while (p < end) {
+      while (p < end && block_char_blank(*p))
+        p++;
+      const u_int8_t *tok = p;
+      while (p < end && !block_char_blank(*p))
+        p++;
+      u64 len = p - tok;
+      if (len == 0)
+        break;
+      if (want_name) {
+        if (!block_index_add((const char *)tok, len, blk))
+          return 0;
+        want_name = 0;
+      } else if (len == 1 && *tok == ':') {
+        want_name = 1;
+      } else if (len == 1 && *tok == '\\') {
+        while (p < end && *p != '\n')
+          p++;
+      } else if (len == 1 && *tok == '(') {
+        while (p < end && *p != ')')
+          p++;
+        p++;
+      }
+    }
+  }
+
+  FILE *f = fopen(block_index_path, "w");
+  if (f) {
+    for (u64 x = 0; x < block_index_len; x++)
+      fprintf(f, "%s %llu\n", block_index_names + block_index[x].name,
+              block_index[x].block);
+    fclose(f);
+    block_index_on_disk = 1;
+  }
+  block_index_valid = 1;
+  return 1;
+}
+
+int block_index_read(void) {
+  FILE *f = fopen(block_index_path, "r");
+  if (!f)
+    return 0;
+  block_index_len = 0;
+  block_index_names_len = 0;
+  char name[256];
+  u64 blk;
+  int ok = 1;
+  while (ok && fscanf(f, "%255s %llu", name, &blk) == 2)
+    ok = blk < NUM_BLOCKS && block_index_add(name, strlen(name), blk);
+  fclose(f);
+  block_index_valid = ok;
+  return ok;
+}
+
+void block_index_word(WORD *w) {
+  UNUSED(w);
+  if (!blocks_base) {
+    printf("%s[ERROR] BLOCKS are not available%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (!block_index_build()) {
+    printf("%s[ERROR] Out of memory building the block index%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  printf("%llu definitions indexed\n", block_index_len);
+}
+
+void where_word(WORD *w) {
+  UNUSED(w);
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  if (len == 0) {
+    printf("%s[ERROR] WHERE expects a name\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (!blocks_base) {
+    printf("%s[ERROR] BLOCKS are not available%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (!block_index_valid && !block_index_read() && !block_index_build()) {
+    printf("%s[ERROR] Out of memory building the block index%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+
+  int found = 0;
+  for (u64 x = 0; x < block_index_len; x++) {
+    if (streq_len(addr, block_index_names + block_index[x].name, len)) {
+      if (!found)
+        printf("%.*s: BLOCK", (int)len, addr);
+      printf(" %llu", block_index[x].block);
+      found = 1;
+    }
+  }
+  if (found)
+    printf("\n");
+  else
+    printf("%.*s is not defined in any block\n", (int)len, addr);
+}
+
+// Key/value store
+//
+// KV-OPEN ( first n -- ) uses blocks [first, first + n) as the pages of a
+// copy-on-write B+tree with u64 keys and byte string values. Pages are
+// numbered from first. Pages 0 and 1 hold two copies of the header, which
+// carries the root page and a bitmap of used pages; the copy with the
+// higher generation and a valid checksum wins. KV-PUT and KV-DEL never
+// write a page the current tree uses: they write new copies of the path to
+// the changed leaf into free pages, msync them, then write the next header
+// into the other slot. A crash at any point leaves one of the two headers
+// describing a complete tree.
+//
+// Leaf:     type n pad | key(8) len(2) value ... (n times)
+// Internal: type n pad | child0(8) | key(8) child(8) ... (n times)
+// Child i of an internal page holds the keys below key i, the last child
+// the rest. Deleting does not merge pages; empty ones are dropped.
+#define KV_MAGIC 0x31564b4854524f46ull // "FORTHKV1"
+#define KV_LEAF 1
+#define KV_INTERNAL 2
+#define KV_NODE_HEADER 8
+#define KV_ENTRY_HEADER 10
+#define KV_MAX_DEPTH 32
+
+typedef struct kv_header {
+  u64 magic;
+  u64 generation;
+  u64 first;
+  u64 count;
+  u64 root; // 0 when the tree is empty
+  u64 keys;
+  u64 checksum;
+  u64 reserved;
+} KV_HEADER; // followed by the page bitmap
+
+typedef struct kv_entry {
+  u64 key;
+  const u_int8_t *value;
+  u64 len;
+} KV_ENTRY;
+
+typedef struct kv_result {
+  u64 left; // 0 when the subtree became empty
+  u64 right; // split off page, or 0
+  u64 separator;
+} KV_RESULT;
+
+u_int8_t *kv_header = NULL; // the committed header, BLOCK_SIZE bytes
+u_int8_t *kv_next = NULL; // the header being built by KV-PUT and KV-DEL
+u64 kv_freed[2 * KV_MAX_DEPTH + 2];
+u64 kv_nfreed = 0;
+int kv_full = 0;
+
+KV_HEADER *kv_head(u_int8_t *h) { return (KV_HEADER *)h; }
+u_int8_t *kv_bitmap(u_int8_t *h) { return h + sizeof(KV_HEADER); }
+u64 kv_max_pages(void) { return (BLOCK_SIZE - sizeof(KV_HEADER)) * 8; }
+u64 kv_max_value(void) {
+  return (BLOCK_SIZE - KV_NODE_HEADER) / 2 - KV_ENTRY_HEADER;
+}
+u64 kv_max_children(void) { return (BLOCK_SIZE - KV_NODE_HEADER - 8) / 16 + 1; }
+
+u_int8_t *kv_page(u64 page) {
+  return blocks_base + (kv_head(kv_header)->first + page) * BLOCK_SIZE;
+}
+
+u64 kv_checksum(u_int8_t *h) {
+  u64 saved = kv_head(h)->checksum;
+  kv_head(h)->checksum = 0;
+  u64 sum = hash_block(h);
+  kv_head(h)->checksum = saved;
+  return sum;
+}
+
+u_int16_t kv_type(const u_int8_t *p) { return *(const u_int16_t *)p; }
+u_int16_t kv_count(const u_int8_t *p) { return *(const u_int16_t *)(p + 2); }
+
+u64 kv_get64(const u_int8_t *p) {
+  u64 v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+void kv_put64(u_int8_t *p, u64 v) { memcpy(p, &v, 8); }
+
+// Pages are taken from the bitmap of kv_next, so a page the committed tree
+// uses is never handed out. Freed pages stay marked until the commit.
+u64 kv_alloc(void) {
+  u_int8_t *bits = kv_bitmap(kv_next);
+  u64 count = kv_head(kv_next)->count;
+  for (u64 page = 2; page < count; page++) {
+    if (!(bits[page / 8] & (1 << (page % 8)))) {
+      bits[page / 8] |= 1 << (page % 8);
+      u64 blk = kv_head(kv_next)->first + page;
+      for (u64 i = 0; i < NUM_BUFFERS; i++) {
+        if (block_buffers[i].block == blk) {
+          block_buffers[i].block = NO_BLOCK;
+          block_buffers[i].dirty = 0;
+          if (current_buffer == &block_buffers[i])
+            current_buffer = NULL;
+        }
+      }
+      block_cache_drop(blk);
+      return page;
+    }
+  }
+  kv_full = 1;
+  return 0;
+}
+
+void kv_free(u64 page) { kv_freed[kv_nfreed++] = page; }
+
+u64 kv_decode_leaf(const u_int8_t *p, KV_ENTRY *e) {
+  u64 n = kv_count(p);
+  const u_int8_t *q = p + KV_NODE_HEADER;
+  for (u64 i = 0; i < n; i++) {
+    u_int16_t len;
+    e[i].key = kv_get64(q);
+    memcpy(&len, q + 8, 2);
+    e[i].len = len;
+    e[i].value = q + KV_ENTRY_HEADER;
+    q += KV_ENTRY_HEADER + len;
+  }
+  return n;
+}
+
+// Writes entries [from, to) to a new leaf page
+u64 kv_write_leaf(KV_ENTRY *e, u64 from, u64 to) {
+  u64 page = kv_alloc();
+  if (!page)
+    return 0;
+  u_int8_t *p = kv_page(page);
+  u_int8_t *q = p + KV_NODE_HEADER;
+  for (u64 i = from; i < to; i++) {
+    u_int16_t len = e[i].len;
+    kv_put64(q, e[i].key);
+    memcpy(q + 8, &len, 2);
+    memmove(q + KV_ENTRY_HEADER, e[i].value, len);
+    q += KV_ENTRY_HEADER + len;
+  }
+  *(u_int16_t *)p = KV_LEAF;
+  *(u_int16_t *)(p + 2) = to - from;
+  return page;
+}
+
+// keys[i] separates children[i] and children[i + 1]
+u64 kv_decode_internal(const u_int8_t *p, u64 *keys, u64 *children) {
+  u64 n = kv_count(p);
+  const u_int8_t *q = p + KV_NODE_HEADER;
+  children[0] = kv_get64(q);
+  for (u64 i = 0; i < n; i++) {
+    keys[i] = kv_get64(q + 8 + 16 * i);
+    children[i + 1] = kv_get64(q + 16 + 16 * i);
+  }
+  return n;
+}
+
+u64 kv_write_internal(u64 *keys, u64 *children, u64 from, u64 to) {
+  u64 page = kv_alloc();
+  if (!page)
+    return 0;
+  u_int8_t *p = kv_page(page);
+  u_int8_t *q = p + KV_NODE_HEADER;
+  kv_put64(q, children[from]);
+  for (u64 i = from; i < to; i++) {
+    kv_put64(q + 8 + 16 * (i - from), keys[i]);
+    kv_put64(q + 16 + 16 * (i - from), children[i + 1]);
+  }
+  *(u_int16_t *)p = KV_INTERNAL;
+  *(u_int16_t *)(p + 2) = to - from;
+  return page;
+}
+
+u64 kv_child_index(u64 *keys, u64 n, u64 key) {
+  u64 lo = 0, hi = n;
+  while (lo < hi) {
+    u64 mid = (lo + hi) / 2;
+    if (key < keys[mid])
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// Index of the first entry with a key >= `key`
+u64 kv_entry_index(KV_ENTRY *e, u64 n, u64 key) {
+  u64 lo = 0, hi = n;
+  while (lo < hi) {
+    u64 mid = (lo + hi) / 2;
+    if (e[mid].key < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Writes the changed leaf, split in two if it no longer fits
+void kv_finish_leaf(KV_ENTRY *e, u64 n, KV_RESULT *r) {
+  u64 total = 0;
+  for (u64 i = 0; i < n; i++)
+    total += KV_ENTRY_HEADER + e[i].len;
+  if (n == 0)
+    return;
+  if (total <= BLOCK_SIZE - KV_NODE_HEADER) {
+    r->left = kv_write_leaf(e, 0, n);
+    return;
+  }
+  // the most even split; both halves fit because a value is at most half
+  // a page
+  u64 split = 1, best = total, left = 0;
+  for (u64 i = 1; i < n; i++) {
+    left += KV_ENTRY_HEADER + e[i - 1].len;
+    u64 worst = left > total - left ? left : total - left;
+    if (worst < best) {
+      best = worst;
+      split = i;
+    }
+  }
+  r->left = kv_write_leaf(e, 0, split);
+  r->right = kv_write_leaf(e, split, n);
+  r->separator = e[split].key;
+}
+
+void kv_finish_internal(u64 *keys, u64 *children, u64 n, KV_RESULT *r) {
+  if (n + 1 <= kv_max_children()) {
+    r->left = kv_write_internal(keys, children, 0, n);
+    return;
+  }
+  u64 half = n / 2;
+  r->left = kv_write_internal(keys, children, 0, half);
+  r->right = kv_write_internal(keys, children, half + 1, n);
+  r->separator = keys[half];
+}
 
-  execute(find_word("PARSE-NAME", 10));
-  u64 len = spop();
-  char *addr = (char *)spop();
-  if (len == 0) {
-    printf("%s[ERROR] INCLUDE expects a name\n%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
+// Copies the path to `key` with the entry replaced, added (value != NULL)
+// or removed (value == NULL). Sets *found when the key existed.
+void kv_update(u64 page, u64 key, const u_int8_t *value, u64 len, int *found,
+               int depth, KV_RESULT *r) {
+  r->left = r->right = r->separator = 0;
+  if (depth >= KV_MAX_DEPTH) {
+    kv_full = 1;
+    return;
+  }
+  if (page == 0) { // empty tree
+    if (value) {
+      KV_ENTRY e = {key, value, len};
+      r->left = kv_write_leaf(&e, 0, 1);
+    }
     return;
   }
-  char *fname = save_string(addr, len);
 
-  if (!fname) {
-    printf("%s[ERROR] INCLUDE expects filename\n%s", SETREDCOLOR,
+  const u_int8_t *p = kv_page(page);
+  if (kv_type(p) == KV_LEAF) {
+    KV_ENTRY *e = malloc((kv_count(p) + 1) * sizeof(KV_ENTRY));
+    if (!e) {
+      kv_full = 1;
+      return;
+    }
+    u64 n = kv_decode_leaf(p, e);
+    u64 i = kv_entry_index(e, n, key);
+    *found = i < n && e[i].key == key;
+    if (!*found && !value) { // nothing to delete, keep the page
+      r->left = page;
+      free(e);
+      return;
+    }
+    if (*found && !value) {
+      memmove(e + i, e + i + 1, (n - i - 1) * sizeof(KV_ENTRY));
+      n--;
+    } else if (*found) {
+      e[i].value = value;
+      e[i].len = len;
+    } else {
+      memmove(e + i + 1, e + i, (n - i) * sizeof(KV_ENTRY));
+      e[i].key = key;
+      e[i].value = value;
+      e[i].len = len;
+      n++;
+    }
+    kv_finish_leaf(e, n, r);
+    kv_free(page);
+    free(e);
+    return;
+  }
+
+  u64 max = kv_count(p) + 2;
+  u64 *keys = malloc(max * sizeof(u64));
+  u64 *children = malloc((max + 1) * sizeof(u64));
+  if (!keys || !children) {
+    free(keys);
+    free(children);
+    kv_full = 1;
+    return;
+  }
+  u64 n = kv_decode_internal(p, keys, children);
+  u64 i = kv_child_index(keys, n, key);
+  KV_RESULT sub;
+  kv_update(children[i], key, value, len, found, depth + 1, &sub);
+  if (sub.left == children[i] && !sub.right) {
+    r->left = page; // unchanged
+  } else if (!kv_full) {
+    int empty = 0;
+    if (sub.left) {
+      children[i] = sub.left;
+      if (sub.right) {
+        memmove(keys + i + 1, keys + i, (n - i) * sizeof(u64));
+        memmove(children + i + 2, children + i + 1, (n - i) * sizeof(u64));
+        keys[i] = sub.separator;
+        children[i + 1] = sub.right;
+        n++;
+      }
+    } else if (n == 0) {
+      empty = 1; // the only child is gone
+    } else { // drop the empty child and one of its separators
+      u64 k = i < n ? i : i - 1;
+      memmove(keys + k, keys + k + 1, (n - k - 1) * sizeof(u64));
+      memmove(children + i, children + i + 1, (n - i) * sizeof(u64));
+      n--;
+    }
+    if (empty)
+      r->left = 0;
+    else if (n == 0 && depth == 0)
+      r->left = children[0]; // a root with one child is replaced by it
+    else
+      kv_finish_internal(keys, children, n, r);
+    kv_free(page);
+  }
+  free(keys);
+  free(children);
+}
+
+// Writes the tree pages, then the header into the slot the committed header
+// does not use.
+int kv_commit(u64 root, long keys_delta) {
+  KV_HEADER *h = kv_head(kv_next);
+  for (u64 i = 0; i < kv_nfreed; i++)
+    kv_bitmap(kv_next)[kv_freed[i] / 8] &= ~(1 << (kv_freed[i] % 8));
+  h->root = root;
+  h->keys += keys_delta;
+  h->generation++;
+  h->checksum = kv_checksum(kv_next);
+
+  block_index_stale();
+  if (!sync_block_range(h->first * BLOCK_SIZE, h->count * BLOCK_SIZE))
+    return 0;
+  u64 slot = h->first + h->generation % 2;
+  memcpy(blocks_base + slot * BLOCK_SIZE, kv_next, BLOCK_SIZE);
+  block_cache_drop(slot);
+  if (!sync_block_range(slot * BLOCK_SIZE, BLOCK_SIZE))
+    return 0;
+  memcpy(kv_header, kv_next, BLOCK_SIZE);
+  return 1;
+}
+
+// KV-PUT with value == NULL is KV-DEL. Returns 1 when the key existed.
+int kv_change(u64 key, const u_int8_t *value, u64 len) {
+  memcpy(kv_next, kv_header, BLOCK_SIZE);
+  kv_nfreed = 0;
+  kv_full = 0;
+  int found = 0;
+  KV_RESULT r;
+  u64 old_root = kv_head(kv_header)->root;
+  kv_update(old_root, key, value, len, &found, 0, &r);
+  if (!kv_full && r.right) { // the root split
+    u64 keys[1] = {r.separator};
+    u64 children[2] = {r.left, r.right};
+    r.left = kv_write_internal(keys, children, 0, 1);
+  }
+  if (kv_full) {
+    printf("%s[ERROR] The key/value store is full%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return found;
+  }
+  if (r.left == old_root && !value)
+    return found; // nothing deleted
+  if (!kv_commit(r.left, value ? !found : -1))
+    print_source_line();
+  return found;
+}
+
+int kv_ready(void) {
+  if (!kv_header) {
+    printf("%s[ERROR] No key/value store is open, see KV-OPEN%s",
+           SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return 0;
+  }
+  return 1;
+}
+
+int kv_header_valid(u_int8_t *h, u64 first, u64 count) {
+  KV_HEADER *k = kv_head(h);
+  return k->magic == KV_MAGIC && k->first == first && k->count == count &&
+         k->checksum == kv_checksum(h);
+}
+
+void kv_open_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 2) {
+    printf("%s[ERROR] KV-OPEN expects first n%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  FILE *f = fopen(fname, "r");
-  if (!f) {
-    printf("%s[ERROR] Could not open %s\n%s", SETREDCOLOR, fname,
+  u64 count = spop();
+  u64 first = spop();
+  if (!blocks_base) {
+    printf("%s[ERROR] BLOCKS are not available%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-  char line[256];
-  while (fgets(line, sizeof(line), f)) {
-    main_interpret_line(line);
+  if (BLOCK_SIZE < 256 || count < 3 || count > kv_max_pages() ||
+      first + count > NUM_BLOCKS || first + count < first) {
+    printf("%s[ERROR] Invalid key/value store: blocks %llu to %llu, at most "
+           "%llu blocks of 256 bytes or more%s",
+           SETREDCOLOR, first, first + count, kv_max_pages(),
+           RESETALLSTYLES);
+    print_source_line();
+    return;
   }
-  fclose(f);
-  printf("%sDONE\n%s", SETGREENCOLOR, RESETALLSTYLES);
-}
+  if (!kv_header) {
+    kv_header = malloc(BLOCK_SIZE);
+    kv_next = malloc(BLOCK_SIZE);
+    if (!kv_header || !kv_next) {
+      free(kv_header);
+      free(kv_next);
+      kv_header = kv_next = NULL;
+      printf("%s[ERROR] Out of memory%s", SETREDCOLOR, RESETALLSTYLES);
+      print_source_line();
+      return;
+    }
+  }
+  // the store may have been written through buffers before
+  wait_flush();
+  if (!save_all_buffers())
+    return;
 
-void interpret(WORD *ww) {
-  UNUSED(ww);
-  f_mode = INTERPRET;
+  u_int8_t *a = blocks_base + first * BLOCK_SIZE;
+  u_int8_t *b = a + BLOCK_SIZE;
+  int va = kv_header_valid(a, first, count);
+  int vb = kv_header_valid(b, first, count);
+  if (va && (!vb || kv_head(a)->generation > kv_head(b)->generation)) {
+    memcpy(kv_header, a, BLOCK_SIZE);
+  } else if (vb) {
+    memcpy(kv_header, b, BLOCK_SIZE);
+  } else { // format: an empty tree in generation 0, written to slot 0
+    memset(kv_header, 0, BLOCK_SIZE);
+    KV_HEADER *h = kv_head(kv_header);
+    h->magic = KV_MAGIC;
+    h->first = first;
+    h->count = count;
+    kv_bitmap(kv_header)[0] = 3;
+    h->checksum = kv_checksum(kv_header);
+    memcpy(a, kv_header, BLOCK_SIZE);
+    memset(b, 0, BLOCK_SIZE);
+    block_cache_drop(first);
+    block_cache_drop(first + 1);
+    block_index_stale();
+    if (!sync_block_range(first * BLOCK_SIZE, 2 * BLOCK_SIZE)) {
+      free(kv_header);
+      free(kv_next);
+      kv_header = kv_next = NULL;
+      print_source_line();
+    }
+  }
 }
 
-void comptime(WORD *ww) {
-  UNUSED(ww);
-  f_mode = COMPILE;
+void kv_put_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 3) {
+    printf("%s[ERROR] KV-PUT expects addr len key%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 key = spop();
+  u64 len = spop();
+  const u_int8_t *value = (const u_int8_t *)spop();
+  if (!kv_ready())
+    return;
+  if (len > kv_max_value()) {
+    printf("%s[ERROR] Values are at most %llu bytes%s", SETREDCOLOR,
+           kv_max_value(), RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  kv_change(key, value, len);
 }
 
-void mode_show(WORD *ww) {
-  UNUSED(ww);
-  if (f_mode == INTERPRET)
-    printf("INTERPRET\n");
-  else
-    printf("COMPILE\n");
+void kv_get_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] KV-GET expects a key%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 key = spop();
+  if (!kv_ready()) {
+    spush(0);
+    return;
+  }
+  u64 page = kv_head(kv_header)->root;
+  u64 keys[BLOCK_SIZE / 16 + 1];
+  u64 children[BLOCK_SIZE / 16 + 2];
+  while (page && kv_type(kv_page(page)) == KV_INTERNAL) {
+    u64 n = kv_decode_internal(kv_page(page), keys, children);
+    page = children[kv_child_index(keys, n, key)];
+  }
+  if (page) {
+    const u_int8_t *p = kv_page(page);
+    const u_int8_t *q = p + KV_NODE_HEADER;
+    for (u64 i = 0; i < kv_count(p); i++) {
+      u_int16_t len;
+      memcpy(&len, q + 8, 2);
+      if (kv_get64(q) == key) {
+        spush((u64)(q + KV_ENTRY_HEADER));
+        spush(len);
+        spush(-1);
+        return;
+      }
+      q += KV_ENTRY_HEADER + len;
+    }
+  }
+  spush(0);
 }
 
-void mode_get(WORD *ww) {
-  UNUSED(ww);
-  if (sp >= (u64)STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+void kv_del_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] KV-DEL expects a key%s", SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
   }
-  spush((u64)f_mode);
+  u64 key = spop();
+  if (!kv_ready()) {
+    spush(0);
+    return;
+  }
+  spush(kv_change(key, NULL, 0) ? -1 : 0);
 }
 
-char *input_cursor_global = NULL;
-char *next_token(char **cursor);
-
-void interpret_token_word(WORD *ww) {
-  UNUSED(ww);
+// Prints the entries with lo <= key <= hi in key order
+u64 kv_range(u64 page, u64 lo, u64 hi) {
+  if (!page)
+    return 0;
+  const u_int8_t *p = kv_page(page);
+  u64 printed = 0;
+  if (kv_type(p) == KV_INTERNAL) {
+    u64 keys[BLOCK_SIZE / 16 + 1];
+    u64 children[BLOCK_SIZE / 16 + 2];
+    u64 n = kv_decode_internal(p, keys, children);
+    for (u64 i = kv_child_index(keys, n, lo); i <= n; i++) {
+      printed += kv_range(children[i], lo, hi);
+      if (i < n && keys[i] > hi)
+        break;
+    }
+    return printed;
+  }
+  const u_int8_t *q = p + KV_NODE_HEADER;
+  for (u64 i = 0; i < kv_count(p); i++) {
+    u_int16_t len;
+    u64 key = kv_get64(q);
+    memcpy(&len, q + 8, 2);
+    if (key >= lo && key <= hi) {
+      printf("%llu %.*s\n", key, (int)len, q + KV_ENTRY_HEADER);
+      printed++;
+    }
+    q += KV_ENTRY_HEADER + len;
+  }
+  return printed;
+}
 
+void kv_range_word(WORD *w) {
+  UNUSED(w);
   if (sp < 2) {
-    printf("%s[ERROR] INTERPRET-TOKEN expects addr len\n%s", SETREDCOLOR,
+    printf("%s[ERROR] KV-RANGE expects lo hi%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
+  u64 hi = spop();
+  u64 lo = spop();
+  if (!kv_ready())
+    return;
+  u64 n = kv_range(kv_head(kv_header)->root, lo, hi);
+  printf("%llu of %llu keys\n", n, kv_head(kv_header)->keys);
+}
 
-  u64 len = spop();
-  char *addr = (char *)spop();
+void editor_block_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush((u64)&curr_block_num);
+}
 
-  WORD *w = find_word(addr, len);
+void number_base_ptr_word(WORD *w) {
+  UNUSED(w);
+  if (sp >= STACK_SIZE) {
+    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  spush((u64)&num_base);
+}
 
-  if (w) {
-    if (f_mode == INTERPRET) {
-      execute(w);
-    } else {
-      if (w->flags & IMMEDIATE)
-        execute(w);
-      else
-        code_space[code_idx++] = (u64)w;
-    }
-  } else {
-    char tmp[64];
-    char *end;
+void fill_word(WORD *w) {
+  UNUSED(w);
 
-    if (sizeof(tmp) < len) {
-      printf("%sToken to long: %.*s\n%s", SETREDCOLOR, (int)len, addr,
-             RESETALLSTYLES);
-      exit(EXIT_FAILURE);
-    }
+  u64 val = spop();
+  u64 size = spop();
+  u64 *addr = (u64 *)spop();
+  memset(addr, val, size);
+}
 
-    memcpy(tmp, addr, len);
-    tmp[len] = '\0';
-    u64 n = strtoull(tmp, &end, num_base);
-    if (*end == '\0') {
-      if (f_mode == INTERPRET)
-        spush(n);
-      else {
-        WORD *litw = find_word("LIT", 3);
-        code_space[code_idx++] = (u64)litw;
-        code_space[code_idx++] = n;
-      }
+// An ICL instruction is a base cell and a payload cell. The base cell holds
+// up to 7 instruction bytes in bits 0-55, their count in bits 56-59 and, in
+// bits 60-63, how many low bytes of the payload (an immediate or a
+// displacement) follow them.
+#define ICL_MAX_LEN 15 // fits a JIT_FRAGMENT_LEN fragment with its ret
+
+u64 icl_encode(unsigned char *to, u64 instr, u64 payload) {
+  u64 len = (instr >> 56) & 0xF;
+  u64 payload_len = instr >> 60;
+  if (len > 7)
+    len = 7;
+  if (payload_len > CELLSIZE)
+    payload_len = CELLSIZE;
+  memcpy(to, &instr, len);
+  memcpy(to + len, &payload, payload_len);
+  return len + payload_len;
+}
 
-    } else {
-      printf("%sUnknown word: %.*s\n%s", SETREDCOLOR, (int)len, addr,
-             RESETALLSTYLES);
-      print_source_line();
-      return;
-    }
+// CODE name ... END-CODE
+//
+// Between the two, EXEC-CODE (and so ;asm) appends each instruction to
+// code_buf instead of running it. END-CODE copies the buffer into JIT memory
+// between the entry and exit sequences of native words (see native_compile)
+// and installs it as a primitive, so the instructions run with rbx = top of
+// stack, r12 = stack base, r13 = sp, and the word is called directly by the
+// inner interpreters and the native backend. rax, rcx, rdx, rsi, rdi and
+// r8-r11 are free; rbp, r14 and r15 must be saved by code that uses them.
+unsigned char *code_buf = NULL;
+u64 code_buf_len = 0;
+u64 code_buf_cap = 0;
+char *code_buf_name = NULL; // word being assembled, NULL outside CODE
+
+// Labels and jumps inside CODE. CODE-LABEL binds a number to the current
+// offset in code_buf. A jump encoder emits its opcode with a zero rel8 or
+// rel32 and CODE-FIXUP records that field; END-CODE patches every field with
+// the distance to its label, backward and forward references alike, and
+// refuses to define the word if a label is missing or a rel8 is out of range.
+typedef struct code_label {
+  u64 id;
+  u64 at;
+} CODE_LABEL;
+
+typedef struct code_fixup {
+  u64 id;
+  u64 at;   // offset of the rel8/rel32 field in code_buf
+  u64 size; // 1 or 4
+} CODE_FIXUP;
+
+CODE_LABEL *code_labels = NULL;
+u64 code_labels_len = 0;
+u64 code_labels_cap = 0;
+CODE_FIXUP *code_fixups = NULL;
+u64 code_fixups_len = 0;
+u64 code_fixups_cap = 0;
+
+int code_buf_append(u64 instr, u64 payload) {
+  if (code_buf_len + ICL_MAX_LEN > code_buf_cap) {
+    u64 cap = code_buf_cap ? code_buf_cap * 2 : 256;
+    unsigned char *b = realloc(code_buf, cap);
+    if (!b)
+      return 0;
+    code_buf = b;
+    code_buf_cap = cap;
   }
+  code_buf_len += icl_encode(code_buf + code_buf_len, instr, payload);
+  return 1;
 }
 
-int c_next_token(char **addr, u64 *len) {
-retrypoint:
-  while (input_index < current_line_length &&
-         isspace((unsigned char)current_line_buffer[input_index]))
-    input_index++;
-
-  if (input_index >= current_line_length)
-    return 0;
+CODE_LABEL *code_label_find(u64 id) {
+  for (u64 x = 0; x < code_labels_len; x += 1)
+    if (code_labels[x].id == id)
+      return &code_labels[x];
+  return NULL;
+}
 
-  if (current_line_buffer[input_index] == '\\') {
-    input_index = current_line_length;
-    return 0;
+// patches the jumps of code_buf, 0 (after printing why) if one can't be
+int code_resolve(void) {
+  for (u64 x = 0; x < code_fixups_len; x += 1) {
+    CODE_FIXUP *f = &code_fixups[x];
+    CODE_LABEL *l = code_label_find(f->id);
+    if (!l) {
+      printf("%s[ERROR] CODE %s: label %llu is not defined\n%s", SETREDCOLOR,
+             code_buf_name, f->id, RESETALLSTYLES);
+      return 0;
+    }
+    long long rel = (long long)l->at - (long long)(f->at + f->size);
+    if (f->size == 1) {
+      if (rel < -128 || rel > 127) {
+        printf("%s[ERROR] CODE %s: label %llu is %lld bytes away, too far "
+               "for a short jump\n%s",
+               SETREDCOLOR, code_buf_name, f->id, rel, RESETALLSTYLES);
+        return 0;
+      }
+      code_buf[f->at] = (unsigned char)(signed char)rel;
+    } else {
+      int rel32 = (int)rel;
+      memcpy(&code_buf[f->at], &rel32, 4);
+    }
   }
+  return 1;
+}
 
-  if (current_line_buffer[input_index] == '(') {
-    input_index++;
-    while (input_index < current_line_length &&
-           current_line_buffer[input_index] != ')')
-      input_index++;
-
-    if (input_index < current_line_length &&
-        current_line_buffer[input_index] == ')')
-      input_index++;
+void code_label_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 1) {
+    printf("%s[ERROR] CODE-LABEL expects a label\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 id = spop();
+  if (!code_buf_name) {
+    printf("%s[ERROR] CODE-LABEL outside CODE\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (code_label_find(id)) {
+    printf("%s[ERROR] CODE %s: label %llu is already defined\n%s",
+           SETREDCOLOR, code_buf_name, id, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (code_labels_len == code_labels_cap) {
+    u64 cap = code_labels_cap ? code_labels_cap * 2 : 16;
+    CODE_LABEL *l = realloc(code_labels, cap * sizeof(CODE_LABEL));
+    if (!l)
+      return;
+    code_labels = l;
+    code_labels_cap = cap;
+  }
+  code_labels[code_labels_len++] = (CODE_LABEL){id, code_buf_len};
+}
 
-    goto retrypoint;
+// ( label size -- ) the last size bytes appended jump to label
+void code_fixup_word(WORD *w) {
+  UNUSED(w);
+  if (sp < 2) {
+    printf("%s[ERROR] CODE-FIXUP expects a label and a size\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  u64 size = spop();
+  u64 id = spop();
+  if (!code_buf_name) {
+    printf("%s[ERROR] CODE-FIXUP outside CODE\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if ((size != 1 && size != 4) || size > code_buf_len) {
+    printf("%s[ERROR] CODE-FIXUP: a jump field is 1 or 4 bytes\n%s",
+           SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
   }
-
-  char *start = current_line_buffer + input_index;
-
-  while (input_index < current_line_length &&
-         !isspace((unsigned char)current_line_buffer[input_index]))
-    input_index++;
-
-  *addr = start;
-  *len = (current_line_buffer + input_index) - start;
-  return 1;
+  if (code_fixups_len == code_fixups_cap) {
+    u64 cap = code_fixups_cap ? code_fixups_cap * 2 : 16;
+    CODE_FIXUP *f = realloc(code_fixups, cap * sizeof(CODE_FIXUP));
+    if (!f)
+      return;
+    code_fixups = f;
+    code_fixups_cap = cap;
+  }
+  code_fixups[code_fixups_len++] =
+      (CODE_FIXUP){id, code_buf_len - size, size};
 }
 
-void parse_name_word(WORD *w) {
-  UNUSED(w);
+// EXEC-CODE cache, slot n owns fragment n of JIT memory
+typedef struct jit_fragment {
+  u64 instr;
+  u64 payload;
+  void (*fn)(void);
+} JIT_FRAGMENT;
 
-  char *src = current_line_buffer;
-  u64 len_src = current_line_length;
-  u64 i = input_index;
+JIT_FRAGMENT jit_fragments[JIT_FRAGMENTS];
 
-  while (i < len_src && isspace((unsigned char)src[i]))
-    i++;
+void exec_code(WORD *w) {
+  UNUSED(w);
+  u64 payload = spop();
+  u64 instr = spop();
 
-  if (i >= len_src) {
-    spush(0);
-    spush(0);
-    input_index = i;
+  if (code_buf_name) {
+    if (!code_buf_append(instr, payload)) {
+      printf("%s[ERROR] CODE %s: out of memory\n%s", SETREDCOLOR,
+             code_buf_name, RESETALLSTYLES);
+      print_source_line();
+    }
     return;
   }
 
-  char *start = src + i;
-
-  while (i < len_src && !isspace((unsigned char)src[i]))
-    i++;
-
-  input_index = i;
-  spush((u64)start);
-  spush((u64)(src + i - start));
+  // instructions are run over and over (a word like %mov-imm64 runs one
+  // each time it is called), so each is encoded once into a fragment of the
+  // JIT cache and called from there until another instruction takes its slot
+  u64 payload_len = instr >> 60;
+  if (payload_len < CELLSIZE)
+    payload &= (1ull << (payload_len * 8)) - 1;
+  u64 h = (instr ^ (payload * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+  JIT_FRAGMENT *f = &jit_fragments[h >> 52 & (JIT_FRAGMENTS - 1)];
+
+  if (!f->fn || f->instr != instr || f->payload != payload) {
+    unsigned char *buf = jit_rw + (u64)(f - jit_fragments) * JIT_FRAGMENT_LEN;
+    u64 len = icl_encode(buf, instr, payload);
+    buf[len] = 0xC3; // ret
+    __builtin___clear_cache((char *)jit_x(buf), (char *)jit_x(buf + len + 1));
+    f->instr = instr;
+    f->payload = payload;
+    f->fn = (void (*)(void))jit_x(buf);
+  }
+  f->fn();
 }
 
-void parse_string_word(WORD *w) {
+void code_word(WORD *w) {
   UNUSED(w);
-
-  char *src = current_line_buffer;
-  u64 len_src = current_line_length;
-  u64 i = input_index;
-
-  while (i < len_src && isspace((unsigned char)src[i]))
-    i++;
-
-  if (i >= len_src) {
-    spush(0);
-    spush(0);
-    input_index = i;
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+#if defined(__x86_64__)
+  if (len == 0) {
+    printf("%s[ERROR] CODE expects a name\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
     return;
   }
-
-  char *start = src + i;
-
-  while (i < len_src && (unsigned char)src[i] != '"')
-    i++;
-
-  input_index = i + 1;
-  spush((u64)start);
-  spush((u64)(src + i - start));
+  if (code_buf_name) {
+    printf("%s[ERROR] CODE %s was not ended, discarding it\n%s", SETREDCOLOR,
+           code_buf_name, RESETALLSTYLES);
+    free(code_buf_name);
+  }
+  code_buf_name = strndup(addr, len);
+  code_buf_len = 0;
+  code_labels_len = 0;
+  code_fixups_len = 0;
+#else
+  UNUSED(addr);
+  UNUSED(len);
+  printf("%s[ERROR] CODE needs the x86-64 backend\n%s", SETREDCOLOR,
+         RESETALLSTYLES);
+  print_source_line();
+#endif
 }
 
-void interpret_line_c_word(WORD *w) {
-  UNUSED(w);
-
-  u64 len;
-  char *addr;
-
-  while (c_next_token(&addr, &len)) {
-
-    if (len == 0)
-      break;
-
-    spush((u64)addr);
-    spush(len);
-    interpret_token_word(NULL);
-  }
+// code of MACHINE words loaded from an image, which has the addresses of the
+// process that saved it baked in
+void machine_stale(WORD *w) {
+  printf("%s[ERROR] %s was assembled by another process, run its CODE "
+         "definition again\n%s",
+         SETREDCOLOR, w->name, RESETALLSTYLES);
+  print_source_line();
 }
 
-void system_word(WORD *w) {
+void end_code_word(WORD *w) {
   UNUSED(w);
-  if (f_mode == COMPILE) {
-    WORD *word = find_word("SHELL-CMD", 9);
-    code_space[code_idx++] = (u64)word;
+  if (!code_buf_name) {
+    printf("%s[ERROR] END-CODE without CODE\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
     return;
   }
-  if (sp < 2) {
-    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+  int resolved = code_resolve();
+  char *src = code_buf_name;
+  code_buf_name = NULL;
+  if (!resolved) {
     print_source_line();
+    free(src);
     return;
   }
-  u64 len = spop();
-  char *start = (char *)spop();
-  char *command = save_string(start, len);
-  system(command);
-}
-
-void blocks_base_word(WORD *w) {
-  UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+#if defined(__x86_64__)
+  // entry and exit together take less than NATIVE_WRAPPER_LEN bytes
+  unsigned char *entry = jit_alloc(code_buf_len + NATIVE_WRAPPER_LEN);
+  if (here + 1 >= (u64)MAX_WORDS) {
+    printf("%s[ERROR] Max number of WORDS reached in dictionary area\n%s",
+           SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
+    free(src);
     return;
   }
-  spush((u64)blocks_base);
-}
-void block_size_word(WORD *w) {
-  UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
+  if (!entry) {
+    printf("%s[ERROR] CODE %s: JIT memory is full\n%s", SETREDCOLOR, src,
+           RESETALLSTYLES);
     print_source_line();
+    free(src);
     return;
   }
-  spush(BLOCK_SIZE);
+
+  dict_mark_take();
+  char *name = intern_string(src, strlen(src));
+  free(src);
+
+  native_p = entry;
+  nat_enter();
+  nat_emit((const char *)code_buf, code_buf_len);
+  nat_leave();
+  jit_commit(entry, native_p);
+
+  WORD *nw = &dictionary[here++];
+  nw->name = name;
+  nw->code = (void (*)(WORD *))jit_x(entry);
+  nw->continuation = NULL;
+  nw->data = NULL;
+  nw->flags = MACHINE;
+  nw->op = OP_CALL;
+  dict_index_insert(nw);
+#else
+  free(src);
+#endif
 }
-void interpret_block_word(WORD *w) {
+
+// CPUID ( leaf subleaf -- eax ebx ecx edx )
+void cpuid_word(WORD *w) {
   UNUSED(w);
   if (sp < 2) {
-    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+    printf("%s[ERROR] CPUID expects a leaf and a subleaf\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
     print_source_line();
     return;
   }
-  u64 blk_len = spop();
-  char *base = (char *)spop();
-
-  char *p = base;
-  char *end = base + blk_len;
-
-  while (p < end) {
-    char *line_start = p;
-
-    while (p < end && *p != '\n')
-      p++;
+  if (sp + 2 > STACK_SIZE) {
+    printf("%s[ERROR] Stack is full\n%s", SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  unsigned subleaf = (unsigned)spop();
+  unsigned leaf = (unsigned)spop();
+  unsigned a = 0, b = 0, c = 0, d = 0;
+#if defined(__x86_64__)
+  __cpuid_count(leaf, subleaf, a, b, c, d);
+#else
+  UNUSED(leaf);
+  UNUSED(subleaf);
+#endif
+  spush(a);
+  spush(b);
+  spush(c);
+  spush(d);
+}
 
-    char nl_saved = *p;
-    *p = '\0';
+// CPU-FEATURES ( -- mask ) bit n is set when the CPU supports feature n and,
+// for the AVX ones, the OS saves the ymm/zmm state. arch/x86_64.fs names the
+// bits.
+void cpu_features_word(WORD *w) {
+  UNUSED(w);
+  u64 mask = 0;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  mask |= (u64)!!__builtin_cpu_supports("sse2") << 0;
+  mask |= (u64)!!__builtin_cpu_supports("ssse3") << 1;
+  mask |= (u64)!!__builtin_cpu_supports("sse4.1") << 2;
+  mask |= (u64)!!__builtin_cpu_supports("sse4.2") << 3;
+  mask |= (u64)!!__builtin_cpu_supports("popcnt") << 4;
+  mask |= (u64)!!__builtin_cpu_supports("avx") << 5;
+  mask |= (u64)!!__builtin_cpu_supports("avx2") << 6;
+  mask |= (u64)!!__builtin_cpu_supports("bmi2") << 7;
+  mask |= (u64)!!__builtin_cpu_supports("avx512f") << 8;
+#endif
+  spush(mask);
+}
 
-    main_interpret_line(line_start);
+void main_stack_address(WORD *w) {
+  UNUSED(w);
+  spush((u64)stack);
+}
+void main_stack_p_address(WORD *w) {
+  UNUSED(w);
+  spush((u64)&sp);
+}
+void return_stack_address(WORD *w) {
+  UNUSED(w);
+  spush((u64)rstack);
+}
+void return_stack_p_address(WORD *w) {
+  UNUSED(w);
+  spush((u64)&rsp);
+}
 
-    *p = nl_saved;
+// Dictionary images
+//
+// SAVE-IMAGE writes the dictionary, its hash index, code space, data space
+// and blob space plus their fill pointers to a file. `skforth --image <file>`
+// maps that file back in instead of running config.fs, init() and
+// bootstrap.fs.
+//
+// Layout: header, then one page aligned section per region. Dictionary,
+// index and code space sections are as large as the region (the file is
+// sparse) and are mapped MAP_PRIVATE straight from the file, code space over
+// the start of a fresh reservation. Data and blob space are copied into their
+// reservations.
+//
+// Regions are mapped back at the addresses they had when saved whenever
+// possible. C pointers (code, names) are always shifted by the load bias of
+// the executable. If a region has to move, pointers into it are relocated:
+// dictionary fields and the cells of every colon definition, including LIT
+// operands that fall inside a saved region. Raw data space contents are not
+// relocated.
+#define IMAGE_MAGIC "SKFIMG01"
+#define IMAGE_BUILD __DATE__ " " __TIME__
+
+typedef struct image_header {
+  char magic[8];
+  char build[32];
+  u64 word_size;
+  u64 op_count;
+
+  u64 block_size;
+  u64 num_blocks;
+  u64 num_buffers;
+  u64 stack_size;
+  u64 max_words;
+  u64 max_code_space;
+  u64 cf_stack;
+  u64 data_size;
+  u64 max_bytes_space;
+
+  u64 here;
+  u64 code_idx;
+  u64 dp;
+  u64 bytes_p;
+  u64 num_base;
+  u64 last_created; // dictionary index + 1, 0 when none
+  u64 dict_index_size;
+
+  // addresses at save time
+  u64 exe_base;
+  u64 dictionary;
+  u64 code_space;
+  u64 data_space;
+  u64 bytes_space;
+
+  // file offsets of each section
+  u64 off_dictionary;
+  u64 off_dict_index;
+  u64 off_code_space;
+  u64 off_data_space;
+  u64 off_bytes_space;
+  u64 file_size;
+} IMAGE_HEADER;
+
+int pwrite_all(int fd, const void *buf, u64 len, u64 off) {
+  const char *p = buf;
+  while (len) {
+    ssize_t r = pwrite(fd, p, len, off);
+    if (r <= 0)
+      return 0;
+    p += r;
+    off += r;
+    len -= r;
+  }
+  return 1;
+}
 
-    if (p < end)
-      p++;
+int pread_all(int fd, void *buf, u64 len, u64 off) {
+  char *p = buf;
+  while (len) {
+    ssize_t r = pread(fd, p, len, off);
+    if (r <= 0)
+      return 0;
+    p += r;
+    off += r;
+    len -= r;
   }
+  return 1;
 }
-void load_external_editor_buffer(WORD *w) {
-  if (sp < 2) {
-    UNUSED(w);
-    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+
+void save_image_word(WORD *w) {
+  UNUSED(w);
+  if (f_mode == COMPILE || current_def) {
+    printf("%s[ERROR] SAVE-IMAGE only valid in interpret mode\n%s",
+           SETREDCOLOR, RESETALLSTYLES);
     print_source_line();
     return;
   }
-  u64 blk_len = spop();
-  char *base = (char *)spop();
-
-  // We close and reopen the file to force state re-synchronization.
-  // After an external editor (fork+exec via system()), the file descriptor
-  // state (offsets, cache associations) can become incoherent when mixing
-  // mmap and stdio I/O.
-  // Closing and reopening forces inode and page-cache revalidation.
-  //
-  //  NOTE: This is not a data sync issue (msync/fsync are insufficient here),
-  // but a file-descriptor state issue after external modification. I assume
-  close(tmp_block_editor_fd);
-  char line[256];
-  char *home = getenv("HOME");
-  if (home == NULL) {
-    fprintf(stderr, "%sError: HOME environment variable not found.%s\n",
-            SETREDCOLOR, RESETALLSTYLES);
-    exit(EXIT_FAILURE);
-  }
-  sprintf(line, "%s/.config/skforth/block_editor.fs", home);
 
-  tmp_block_editor_fd = open(line, O_RDWR);
-
-  lseek(tmp_block_editor_fd, 0, SEEK_SET);
-  ftruncate(tmp_block_editor_fd, BLOCK_SIZE);
-  int res = write(tmp_block_editor_fd, base, blk_len * sizeof(char));
-  if (res == -1) {
-    printf("%s[ERROR] Could not load BLOCK to tmp editor buffer%s", SETREDCOLOR,
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  char path[256];
+  if (len == 0 || len >= sizeof(path)) {
+    printf("%s[ERROR] SAVE-IMAGE expects a file name\n%s", SETREDCOLOR,
            RESETALLSTYLES);
     print_source_line();
     return;
   }
-}
-void save_external_editor_buffer(WORD *w) {
-  UNUSED(w);
-  if (sp < 1) {
-    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
+  memcpy(path, addr, len);
+  path[len] = '\0';
+
+  IMAGE_HEADER h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, IMAGE_MAGIC, sizeof(h.magic));
+  snprintf(h.build, sizeof(h.build), "%s", IMAGE_BUILD);
+  h.word_size = sizeof(WORD);
+  h.op_count = OP_COUNT;
+
+  h.block_size = BLOCK_SIZE;
+  h.num_blocks = NUM_BLOCKS;
+  h.num_buffers = NUM_BUFFERS;
+  h.stack_size = STACK_SIZE;
+  h.max_words = MAX_WORDS;
+  h.max_code_space = MAX_CODE_SPACE;
+  h.cf_stack = CF_STACK;
+  h.data_size = DATA_SIZE;
+  h.max_bytes_space = MAX_BYTES_SPACE;
+
+  h.here = here;
+  h.code_idx = code_idx;
+  h.dp = dp;
+  h.bytes_p = bytes_p;
+  h.num_base = num_base;
+  h.last_created = last_created ? (u64)(last_created - dictionary) + 1 : 0;
+  h.dict_index_size = dict_index_size;
+
+  h.exe_base = (u64)init;
+  h.dictionary = (u64)dictionary;
+  h.code_space = (u64)code_space;
+  h.data_space = (u64)data_space;
+  h.bytes_space = (u64)bytes_space;
+
+  h.off_dictionary = page_round(sizeof(h));
+  h.off_dict_index =
+      h.off_dictionary + page_round(MAX_WORDS * sizeof(WORD));
+  h.off_code_space =
+      h.off_dict_index + page_round(dict_index_size * CELLSIZE);
+  h.off_data_space =
+      h.off_code_space + page_round(MAX_CODE_SPACE * CELLSIZE);
+  h.off_bytes_space = h.off_data_space + page_round(dp * CELLSIZE);
+  h.file_size = h.off_bytes_space + page_round(bytes_p);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    printf("%s[ERROR] Could not create image %s\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, path, strerror(errno), RESETALLSTYLES);
     print_source_line();
     return;
   }
-  u64 blk_idx = spop();
 
-  // We close and reopen the file to force state re-synchronization.
-  // After an external editor (fork+exec via system()), the file descriptor
-  // state (offsets, cache associations) can become incoherent when mixing
-  // mmap and stdio I/O.
-  // Closing and reopening forces inode and page-cache revalidation.
-  //
-  //  NOTE: This is not a data sync issue (msync/fsync are insufficient here),
-  // but a file-descriptor state issue after external modification. I assume
-  close(tmp_block_editor_fd);
-  char line[256];
-  char *home = getenv("HOME");
-  if (home == NULL) {
-    fprintf(stderr, "%sError: HOME environment variable not found.%s\n",
-            SETREDCOLOR, RESETALLSTYLES);
-    exit(EXIT_FAILURE);
+  // only the used part of each region is written, the rest stays a hole
+  if (ftruncate(fd, h.file_size) == -1 ||
+      !pwrite_all(fd, &h, sizeof(h), 0) ||
+      !pwrite_all(fd, dictionary, here * sizeof(WORD), h.off_dictionary) ||
+      !pwrite_all(fd, dict_index, dict_index_size * CELLSIZE,
+                  h.off_dict_index) ||
+      !pwrite_all(fd, code_space, code_idx * CELLSIZE, h.off_code_space) ||
+      !pwrite_all(fd, data_space, dp * CELLSIZE, h.off_data_space) ||
+      !pwrite_all(fd, bytes_space, bytes_p, h.off_bytes_space)) {
+    printf("%s[ERROR] Could not write image %s\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, path, strerror(errno), RESETALLSTYLES);
+    print_source_line();
+    close(fd);
+    return;
   }
-  sprintf(line, "%s/.config/skforth/block_editor.fs", home);
+  close(fd);
+  printf("%sImage saved to %s (%llu WORDS)\n%s", SETGREENCOLOR, path, here,
+         RESETALLSTYLES);
+}
 
-  tmp_block_editor_fd = open(line, O_RDWR);
+// map a region at its saved address if that range is free, anywhere else
+// otherwise. fd == -1 maps anonymous memory
+void *map_image_region(u64 hint, u64 len, int prot, int fd, u64 off) {
+  int flags = fd == -1 ? MAP_ANONYMOUS | MAP_SHARED : MAP_PRIVATE;
+  void *p = mmap((void *)hint, len, prot, flags | MAP_FIXED_NOREPLACE, fd,
+                 fd == -1 ? 0 : (off_t)off);
+  if (p == MAP_FAILED)
+    p = mmap(NULL, len, prot, flags, fd, fd == -1 ? 0 : (off_t)off);
+  return p;
+}
+
+u64 image_reloc(IMAGE_HEADER *h, u64 v) {
+  if (v >= h->dictionary && v < h->dictionary + MAX_WORDS * sizeof(WORD))
+    return v - h->dictionary + (u64)dictionary;
+  if (v >= h->code_space && v < h->code_space + MAX_CODE_SPACE * CELLSIZE)
+    return v - h->code_space + (u64)code_space;
+  if (v >= h->data_space &&
+      v < h->data_space + DATA_SIZE * CELLSIZE)
+    return v - h->data_space + (u64)data_space;
+  if (v >= h->bytes_space && v < h->bytes_space + MAX_BYTES_SPACE)
+    return v - h->bytes_space + (u64)bytes_space;
+  return v;
+}
+
+void resolve_internal_words(void);
 
-  if (blk_idx >= NUM_BLOCKS) {
-    printf("%s[ERROR] Invalid block index: %llu %s", SETREDCOLOR, blk_idx,
+int load_image(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    printf("%s[ERROR] Could not open image %s\n[SYS MSG] %s%s\n", SETREDCOLOR,
+           path, strerror(errno), RESETALLSTYLES);
+    return 0;
+  }
+
+  IMAGE_HEADER h;
+  struct stat st;
+  if (!pread_all(fd, &h, sizeof(h), 0) || fstat(fd, &st) == -1 ||
+      memcmp(h.magic, IMAGE_MAGIC, sizeof(h.magic)) != 0 ||
+      (u64)st.st_size < h.file_size) {
+    printf("%s[ERROR] %s is not a skforth image\n%s", SETREDCOLOR, path,
            RESETALLSTYLES);
-    print_source_line();
-    return;
+    close(fd);
+    return 0;
+  }
+  if (strncmp(h.build, IMAGE_BUILD, sizeof(h.build)) != 0 ||
+      h.word_size != sizeof(WORD) || h.op_count != OP_COUNT) {
+    printf("%s[ERROR] %s was saved by a different skforth build\n%s",
+           SETREDCOLOR, path, RESETALLSTYLES);
+    close(fd);
+    return 0;
+  }
+
+  BLOCK_SIZE = h.block_size;
+  NUM_BLOCKS = h.num_blocks;
+  NUM_BUFFERS = h.num_buffers;
+  STACK_SIZE = h.stack_size;
+  MAX_WORDS = h.max_words;
+  MAX_CODE_SPACE = h.max_code_space;
+  CF_STACK = h.cf_stack;
+  DATA_SIZE = h.data_size;
+  MAX_BYTES_SPACE = h.max_bytes_space;
+  dict_index_size = h.dict_index_size;
+
+  dictionary = map_image_region(h.dictionary, MAX_WORDS * sizeof(WORD),
+                                PROT_READ | PROT_WRITE, fd, h.off_dictionary);
+  dict_index = map_image_region(0, dict_index_size * CELLSIZE,
+                                PROT_READ | PROT_WRITE, fd, h.off_dict_index);
+  // code space is mapped from the file over the start of its reservation
+  code_space = reserve_space(h.code_space, MAX_CODE_SPACE * CELLSIZE,
+                             PROT_NONE, &code_reserve);
+  if (code_space != MAP_FAILED)
+    code_space = mmap(code_space, MAX_CODE_SPACE * CELLSIZE,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_FIXED, fd, h.off_code_space);
+  bytes_space = reserve_space(h.bytes_space, MAX_BYTES_SPACE,
+                              PROT_READ | PROT_WRITE,
+                              &bytes_reserve);
+  data_space = reserve_space(h.data_space, DATA_SIZE * CELLSIZE,
+                             PROT_READ | PROT_WRITE, &data_reserve);
+
+  if (dictionary == MAP_FAILED || dict_index == MAP_FAILED ||
+      code_space == MAP_FAILED || bytes_space == MAP_FAILED ||
+      data_space == MAP_FAILED) {
+    printf("%s[ERROR] MMAP failed to map image %s\n[SYS MSG] %s%s\n",
+           SETREDCOLOR, path, strerror(errno), RESETALLSTYLES);
+    exit(EXIT_FAILURE);
+  }
+  if (!pread_all(fd, data_space, h.dp * CELLSIZE, h.off_data_space) ||
+      !pread_all(fd, bytes_space, h.bytes_p, h.off_bytes_space)) {
+    printf("%s[ERROR] Could not read image %s\n[SYS MSG] %s%s\n", SETREDCOLOR,
+           path, strerror(errno), RESETALLSTYLES);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+
+  here = h.here;
+  code_idx = h.code_idx;
+  dp = h.dp;
+  bytes_p = h.bytes_p;
+  num_base = h.num_base;
+  last_created = h.last_created ? &dictionary[h.last_created - 1] : NULL;
+
+  // relocation
+  u64 exe_delta = (u64)init - h.exe_base;
+  int moved = h.dictionary != (u64)dictionary ||
+              h.code_space != (u64)code_space ||
+              h.data_space != (u64)data_space ||
+              h.bytes_space != (u64)bytes_space;
+
+  for (u64 x = 0; x < here; x += 1) {
+    WORD *dw = &dictionary[x];
+    // names live in blob space or are string literals in the executable
+    u64 name = (u64)dw->name;
+    if (name >= h.bytes_space && name < h.bytes_space + MAX_BYTES_SPACE)
+      name = name - h.bytes_space + (u64)bytes_space;
+    else
+      name += exe_delta;
+    dw->name = (const char *)name;
+    if (dw->flags & MACHINE)
+      dw->code = machine_stale;
+    else if (dw->code)
+      dw->code = (void (*)(WORD *))((u64)dw->code + exe_delta);
+    dw->continuation = (u64 *)image_reloc(&h, (u64)dw->continuation);
+    dw->data = (u64 *)image_reloc(&h, (u64)dw->data);
+    // native code has this process' addresses baked in and compiled C
+    // lives in an object this process hasn't loaded, run the threaded body
+    // they were translated from instead
+    if (dw->flags & (NATIVE | COMPILED_C)) {
+      dw->continuation = dw->data;
+      dw->data = NULL;
+      dw->code = NULL;
+      dw->refs = NULL;
+      dw->op = OP_DOCOL;
+      dw->flags &= ~(u64)(NATIVE | COMPILED_C);
+    }
+  }
+
+  if (moved) {
+    for (u64 x = 0; x < here; x += 1) {
+      u64 *p = dictionary[x].continuation;
+      if (!p || p < code_space || p >= code_space + code_idx)
+        continue;
+      while (p < code_space + code_idx && *p) {
+        WORD *cw = (WORD *)image_reloc(&h, *p);
+        *p++ = (u64)cw;
+        if (word_operand(cw) != OPERAND_NONE) {
+          *p = image_reloc(&h, *p);
+          p++;
+        }
+      }
+    }
   }
 
-  unsigned char *blk_addr =
-      ((unsigned char *)blocks_base) + (blk_idx * BLOCK_SIZE);
+  resolve_internal_words();
+  intern_rebuild();
+  dict_marks_init();
+  dict_fence = here; // no marks are saved for image words
+  return 1;
+}
 
-  lseek(tmp_block_editor_fd, 0, SEEK_SET);
+// Profiler
+//
+// PROFILE-ON makes execute() hand every word to execute_profiled(), a plain
+// walker that brackets each word with a cycle counter read. Per word we keep
+// the call count, inclusive cycles (the word and everything it called, a
+// recursive word counted once per outermost call) and exclusive cycles (the
+// word alone). The table runs parallel to dictionary. With profiling off the
+// only cost is one test on entry to execute().
+#define PROFILE_TOP 20
+
+typedef struct profile_entry {
+  u64 calls;
+  u64 inclusive;
+  u64 exclusive;
+  u64 active; // frames of this word currently open
+} PROFILE_ENTRY;
+
+typedef struct profile_frame {
+  WORD *w;
+  u64 start;
+  u64 child; // inclusive cycles of words it called
+} PROFILE_FRAME;
+
+u64 profiling = 0;
+PROFILE_ENTRY *profile_table = NULL;
+PROFILE_FRAME *profile_frames = NULL;
+u64 profile_frames_size = 0;
+u64 profile_depth = 0;
+
+static inline u64 profile_clock(void) {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+}
 
-  int r = read(tmp_block_editor_fd, blk_addr, BLOCK_SIZE);
-  if (r == -1) {
-    printf("%s\n", strerror(errno));
-    printf("%s[ERROR] Could not load BLOCK to tmp editor buffer%s", SETREDCOLOR,
-           RESETALLSTYLES);
-    print_source_line();
-    return;
+void profile_enter(WORD *w) {
+  if (profile_depth < profile_frames_size) {
+    PROFILE_FRAME *f = &profile_frames[profile_depth];
+    f->w = w;
+    f->child = 0;
+    profile_table[w - dictionary].calls++;
+    profile_table[w - dictionary].active++;
+    f->start = profile_clock();
   }
+  profile_depth++;
 }
 
-void blk_word(WORD *w) {
-  UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
+void profile_leave(void) {
+  u64 now = profile_clock();
+  profile_depth--;
+  if (profile_depth >= profile_frames_size)
     return;
-  }
+  PROFILE_FRAME *f = &profile_frames[profile_depth];
+  PROFILE_ENTRY *e = &profile_table[f->w - dictionary];
+  u64 incl = now - f->start;
+  e->exclusive += incl - f->child;
+  if (--e->active == 0)
+    e->inclusive += incl;
+  if (profile_depth > 0 && profile_depth - 1 < profile_frames_size)
+    profile_frames[profile_depth - 1].child += incl;
+}
 
-  spush(curr_block_num);
+// closes the frames left open by a fault
+void profile_unwind(void) {
+  profile_depth = 0;
+  if (profile_table)
+    for (u64 x = 0; x < here; x += 1)
+      profile_table[x].active = 0;
 }
-void blk_change_word(WORD *w) {
-  UNUSED(w);
-  if (sp < 1) {
-    printf("%s[ERROR] Stack is too small%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
+
+// the classic inner interpreter with a profile frame around every word.
+// Like the threaded one it owns the return stack above its entry rsp
+void execute_profiled(WORD *w) {
+  u64 *saved_ip = ip;
+  u64 rbase = rsp;
+  u64 base = profile_depth;
+
+  profile_enter(w);
+  if (!w->continuation) {
+    if (w->code)
+      w->code(w);
+    profile_leave();
+    ip = saved_ip;
     return;
   }
-  u64 curr_blk = spop();
-  curr_block_num = curr_blk;
-}
-void num_blocks_word(WORD *w) {
-  UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
-    return;
+  ip = w->continuation;
+
+  while (ip) {
+    WORD *cw = (WORD *)*ip++;
+
+    if (!cw || cw->op == OP_EXIT) {
+      profile_leave();
+      if (rsp <= rbase)
+        break;
+      ip = (u64 *)rstack[--rsp];
+      continue;
+    }
+    if (cw->op == OP_TAIL) {
+      WORD *target = (WORD *)*ip;
+      profile_leave();
+      profile_enter(target);
+      ip = target->continuation;
+      continue;
+    }
+
+    u64 *before = ip;
+    if (cw->code) {
+      profile_enter(cw);
+      cw->code(cw);
+      profile_leave();
+    }
+    if (cw->continuation && ip == before) {
+      if (CHECKED(rsp >= STACK_SIZE)) {
+        printf("%s[ERROR] Return stack overflow calling %s\n%s", SETREDCOLOR,
+               cw->name, RESETALLSTYLES);
+        print_source_line();
+        rsp = rbase;
+        break;
+      }
+      rstack[rsp++] = (u64)ip;
+      profile_enter(cw);
+      ip = cw->continuation;
+    }
   }
-  spush(NUM_BLOCKS);
+
+  while (profile_depth > base)
+    profile_leave();
+  ip = saved_ip;
 }
-void editor_dirty_word(WORD *w) {
+
+void profile_on_word(WORD *w) {
   UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
-    return;
+  if (!profile_table) {
+    profile_table = mmap(NULL, MAX_WORDS * sizeof(PROFILE_ENTRY),
+                         PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
+                         -1, 0);
+    // every colon word and every primitive in flight can hold a frame
+    profile_frames_size = 2 * STACK_SIZE + 64;
+    profile_frames = mmap(NULL, profile_frames_size * sizeof(PROFILE_FRAME),
+                          PROT_READ | PROT_WRITE,
+                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (profile_table == MAP_FAILED || profile_frames == MAP_FAILED) {
+      printf("%s[ERROR] MMAP failed to reserve the profile table\n[SYS MSG] "
+             "%s%s\n",
+             SETREDCOLOR, strerror(errno), RESETALLSTYLES);
+      profile_table = NULL;
+      profile_frames_size = 0;
+      return;
+    }
   }
-  spush((u64)&editor_dirty);
+  profiling = 1;
 }
-void editor_block_word(WORD *w) {
+
+void profile_off_word(WORD *w) {
   UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
-    return;
-  }
-  spush((u64)&curr_block_num);
+  profiling = 0;
 }
 
-void number_base_ptr_word(WORD *w) {
+// clears the counters only. The frames still open (PROFILE-RESET itself
+// runs inside some) stay and restart their clocks, so they close normally
+// and count just the time after the reset
+void profile_reset_word(WORD *w) {
   UNUSED(w);
-  if (sp >= STACK_SIZE) {
-    printf("%s[ERROR] Stack is full%s", SETREDCOLOR, RESETALLSTYLES);
-    print_source_line();
+  if (!profile_table)
     return;
+  for (u64 x = 0; x < here; x += 1) {
+    profile_table[x].calls = 0;
+    profile_table[x].inclusive = 0;
+    profile_table[x].exclusive = 0;
+  }
+  u64 now = profile_clock();
+  for (u64 x = 0; x < profile_depth && x < profile_frames_size; x += 1) {
+    profile_frames[x].start = now;
+    profile_frames[x].child = 0;
   }
-  spush((u64)&num_base);
 }
 
-void fill_word(WORD *w) {
-  UNUSED(w);
-
-  u64 val = spop();
-  u64 size = spop();
-  u64 *addr = (u64 *)spop();
-  memset(addr, val, size);
+int profile_cmp(const void *a, const void *b) {
+  u64 x = profile_table[*(const u64 *)a].exclusive;
+  u64 y = profile_table[*(const u64 *)b].exclusive;
+  return x < y ? 1 : x > y ? -1 : 0;
 }
 
-void exec_code(WORD *w) {
+// .profile: top words by exclusive cycles
+void profile_print_word(WORD *w) {
   UNUSED(w);
-  u64 payload = spop();
-  u64 instr = spop();
-
-  char len = instr >> 56;
-  u64 bytes = instr & 0x00FFFFFFFFFFFFFF;
-
-  char *buf = &bytes_space[bytes_p];
+  if (!profile_table) {
+    printf("%s[ERROR] Nothing profiled, use PROFILE-ON first\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    return;
+  }
+  u64 *order = malloc(here * CELLSIZE);
+  u64 n = 0;
+  u64 total = 0;
+  for (u64 x = 0; x < here; x += 1) {
+    if (!profile_table[x].calls)
+      continue;
+    order[n++] = x;
+    total += profile_table[x].exclusive;
+  }
+  qsort(order, n, CELLSIZE, profile_cmp);
 
-  memcpy(buf, &bytes, len);
-  u64 start = bytes_p;
-  bytes_p += len;
+  printf("skforth profile (%s): \n NAME | CALLS | INCLUSIVE | EXCLUSIVE | "
+         "EXCLUSIVE %%\n",
+#if defined(__x86_64__)
+         "cycles"
+#else
+         "ns"
+#endif
+  );
+  for (u64 x = 0; x < n && x < PROFILE_TOP; x += 1) {
+    PROFILE_ENTRY *e = &profile_table[order[x]];
+    printf("[%s] %llu %llu %llu %.1f\n", dictionary[order[x]].name, e->calls,
+           e->inclusive, e->exclusive,
+           total ? 100.0 * (double)e->exclusive / (double)total : 0.0);
+  }
+  free(order);
+}
 
-  memcpy(&bytes_space[bytes_p], &payload, CELLSIZE);
-  bytes_p += CELLSIZE;
+// MARKER and FORGET
+//
+// Every definition records the fill pointers from just before it was made
+// in dict_marks, next to its dictionary slot. FORGET name, or running a word
+// made by MARKER name, rolls here, code space, data space and blob space
+// back to that record. Shadowing in the dictionary index is undone from
+// dict_log, which holds the previous contents of every index slot written
+// since the first mark, so the cost is in the words forgotten, not in the
+// words kept. Words below dict_fence (primitives, and everything in a
+// loaded image) cannot be forgotten.
+typedef struct dict_mark {
+  u64 code_idx;
+  u64 jit_p;
+  u64 dp;
+  u64 bytes_p;
+  u64 log_len;
+} DICT_MARK;
+
+typedef struct dict_log_entry {
+  u64 slot;
+  u64 old;
+} DICT_LOG_ENTRY;
+
+DICT_MARK *dict_marks = NULL;
+DICT_LOG_ENTRY *dict_log = NULL;
+u64 dict_log_len = 0;
+
+void dict_marks_init(void) {
+  dict_marks = mmap(NULL, MAX_WORDS * sizeof(DICT_MARK),
+                    PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1,
+                    0);
+  dict_log = mmap(NULL, MAX_WORDS * sizeof(DICT_LOG_ENTRY),
+                  PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (dict_marks == MAP_FAILED || dict_log == MAP_FAILED) {
+    printf("%s[ERROR] MMAP failed to reserve the MARKER tables\n[SYS MSG] "
+           "%s%s\n",
+           SETREDCOLOR, strerror(errno), RESETALLSTYLES);
+    exit(EXIT_FAILURE);
+  }
+  dict_log_len = 0;
+}
 
-  void (*fn)(void) = (void *)buf;
-  fn();
+// Records the state a definition about to be made at `here` rolls back to
+void dict_mark_take(void) {
+  if (!dict_marks || here >= (u64)MAX_WORDS)
+    return;
+  DICT_MARK *m = &dict_marks[here];
+  m->code_idx = code_idx;
+  m->jit_p = jit_p;
+  m->dp = dp;
+  m->bytes_p = bytes_p;
+  m->log_len = dict_log_len;
+}
 
-  bytes_p = start;
+void dict_log_write(u64 slot) {
+  if (dict_log && dict_log_len < (u64)MAX_WORDS) {
+    dict_log[dict_log_len].slot = slot;
+    dict_log[dict_log_len].old = dict_index[slot];
+    dict_log_len++;
+  }
 }
 
-void main_stack_address(WORD *w) {
-  UNUSED(w);
-  spush((u64)stack);
+void block_cache_forget(u64 index) {
+  for (u64 blk = 0; blk < block_cache_len; blk++) {
+    if (block_cache[blk].hash &&
+        block_cache[blk].first + block_cache[blk].count > index)
+      block_cache_drop(blk);
+  }
 }
-void main_stack_p_address(WORD *w) {
-  UNUSED(w);
-  spush((u64)&sp);
+
+// Forgets dictionary[index] and everything defined after it
+void forget_to(u64 index) {
+  DICT_MARK *m = &dict_marks[index];
+  while (dict_log_len > m->log_len) {
+    dict_log_len--;
+    dict_index[dict_log[dict_log_len].slot] = dict_log[dict_log_len].old;
+  }
+
+  // names saved after the mark leave the intern set before their bytes go
+  char *blob_mark = bytes_space + (m->bytes_p < bytes_p ? m->bytes_p : bytes_p);
+  for (u64 x = index; x < here; x++) {
+    const char *name = dictionary[x].name;
+    if (name >= blob_mark && name < bytes_space + bytes_p)
+      intern_remove(name);
+  }
+  if (profile_table)
+    memset(&profile_table[index], 0, (here - index) * sizeof(PROFILE_ENTRY));
+  block_cache_forget(index);
+  if (last_created >= &dictionary[index])
+    last_created = NULL;
+
+  // clear.d and BLOB-RELEASE may have gone below the mark already
+  here = index;
+  if (m->code_idx < code_idx)
+    code_idx = m->code_idx;
+  if (m->jit_p < jit_p)
+    jit_p = m->jit_p;
+  if (m->dp < dp)
+    dp = m->dp;
+  if (m->bytes_p < bytes_p)
+    bytes_p = m->bytes_p;
 }
-void return_stack_address(WORD *w) {
+
+void marker_run(WORD *w) { forget_to(w - dictionary); }
+
+void marker_word(WORD *w) {
   UNUSED(w);
-  spush((u64)rstack);
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  if (len == 0) {
+    printf("%s[ERROR] MARKER expects a name\n%s", SETREDCOLOR,
+           RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if (here + 1 >= (u64)MAX_WORDS) {
+    printf("%s[ERROR] Max number of WORDS reached in dictionary area\n%s",
+           SETREDCOLOR, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  dict_mark_take();
+  char *name = intern_string(addr, len);
+  WORD *nw = &dictionary[here++];
+  nw->name = name;
+  nw->code = marker_run;
+  nw->continuation = NULL;
+  nw->data = NULL;
+  nw->flags = 0;
+  nw->op = primitive_op(marker_run);
+  dict_index_insert(nw);
 }
-void return_stack_p_address(WORD *w) {
+
+void forget_word(WORD *w) {
   UNUSED(w);
-  spush((u64)&rsp);
+  execute(word_parse_name);
+  u64 len = spop();
+  char *addr = (char *)spop();
+  WORD *fw = len ? find_word(addr, len) : NULL;
+  if (!fw) {
+    printf("%s[ERROR] FORGET: unknown word %.*s\n%s", SETREDCOLOR, (int)len,
+           addr, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  if ((u64)(fw - dictionary) < dict_fence || !dict_marks) {
+    printf("%s[ERROR] FORGET: %.*s is a primitive or part of the image\n%s",
+           SETREDCOLOR, (int)len, addr, RESETALLSTYLES);
+    print_source_line();
+    return;
+  }
+  forget_to(fw - dictionary);
 }
 
 void init(void) {
   add_word("LIT", lit, NULL, 0);
   add_word("0BRANCH", zero_branch, NULL, 0);
   add_word("BRANCH", branch, NULL, 0);
+  // superinstructions, only ever compiled by the optimizer. A name starting
+  // with '(' can't be typed since the tokenizer reads it as a comment
+  add_word("(LIT+)", lit_add, NULL, 0);
+  add_word("(DUP@)", dup_fetch, NULL, 0);
+  add_word("(OVER+)", over_add, NULL, 0);
+  add_word("(0=0BRANCH)", zero_equals_branch, NULL, 0);
+  add_word("(TAIL)", tail_call, NULL, 0);
+  add_word("(DO)", do_runtime, NULL, 0);
+  add_word("(?DO)", qdo_runtime, NULL, 0);
+  add_word("(LOOP)", loop_runtime, NULL, 0);
+  add_word("(+LOOP)", plus_loop_runtime, NULL, 0);
+  add_word("(LEAVE)", leave_runtime, NULL, 0);
   add_word("COMPTIME", comptime, NULL, 0);
   add_word("INTERPRET", interpret, NULL, 0);
   add_word("SOURCE", source_word, NULL, 0);
   add_word(">IN", in_word, NULL, 0);
   add_word("EXEC-CODE", exec_code, NULL, 0);
+  add_word("CODE", code_word, NULL, 0);
+  add_word("END-CODE", end_code_word, NULL, 0);
+  add_word("CODE-LABEL", code_label_word, NULL, 0);
+  add_word("CODE-FIXUP", code_fixup_word, NULL, 0);
   add_word("_stack", main_stack_address, NULL, 0);
   add_word("_sp", main_stack_p_address, NULL, 0);
   add_word("_rstack", return_stack_address, NULL, 0);
   add_word("_rsp", return_stack_p_address, NULL, 0);
+  add_word("CPUID", cpuid_word, NULL, 0);
+  add_word("CPU-FEATURES", cpu_features_word, NULL, 0);
   add_word("NUMBASE", number_base_ptr_word, NULL, 0);
 
   add_word("SHELL-CMD", system_word, NULL, 0);
   add_word("BLOCKS-BASE", blocks_base_word, NULL, 0);
   add_word("BLOCK-SIZE", block_size_word, NULL, 0);
   add_word("INTERPRET-BLOCK", interpret_block_word, NULL, 0);
+  add_word("LOAD", load_word, NULL, 0);
   add_word("LOAD-EXTRN-EDITBUFF", load_external_editor_buffer, NULL, 0);
   add_word("SAVE-EXTRN-EDITBUFF", save_external_editor_buffer, NULL, 0);
   add_word("#BLOCKS", num_blocks_word, NULL, 0);
-  add_word("EDITOR-DIRTY", editor_dirty_word, NULL, 0);
+  add_word("MORE-BLOCKS", more_blocks_word, NULL, 0);
+  add_word("BLOCK-SEARCH", block_search_word, NULL, 0);
+  add_word("BLOCK-INDEX", block_index_word, NULL, 0);
+  add_word("WHERE", where_word, NULL, 0);
+  add_word("KV-OPEN", kv_open_word, NULL, 0);
+  add_word("KV-PUT", kv_put_word, NULL, 0);
+  add_word("KV-GET", kv_get_word, NULL, 0);
+  add_word("KV-DEL", kv_del_word, NULL, 0);
+  add_word("KV-RANGE", kv_range_word, NULL, 0);
+  add_word("BLOCK", block_word, NULL, 0);
+  add_word("BUFFER", buffer_word, NULL, 0);
+  add_word("UPDATE", update_word, NULL, 0);
+  add_word("SAVE-BUFFERS", save_buffers_word, NULL, 0);
+  add_word("EMPTY-BUFFERS", empty_buffers_word, NULL, 0);
+  add_word("FLUSH", flush_word, NULL, 0);
+  add_word("FLUSH-ASYNC", flush_async_word, NULL, 0);
+  add_word("WAIT-FLUSH", wait_flush_word, NULL, 0);
+  add_word("#BUFFERS", num_buffers_word, NULL, 0);
   add_word("EDITOR-BLOCK", editor_block_word, NULL, 0);
   add_word("BLK", blk_word, NULL, 0);
   add_word("BLK!", blk_change_word, NULL, 0);
@@ -1682,6 +6473,10 @@ void init(void) {
   add_word(".mode", mode_show, NULL, 0);
   add_word("mode", mode_get, NULL, 0);
   add_word(".memstats", allstats, NULL, 0);
+  add_word("PROFILE-ON", profile_on_word, NULL, 0);
+  add_word("PROFILE-OFF", profile_off_word, NULL, 0);
+  add_word("PROFILE-RESET", profile_reset_word, NULL, 0);
+  add_word(".profile", profile_print_word, NULL, 0);
   add_word(".s", dot_stack, NULL, 0);
   add_word("cr", cr, NULL, 0);
   add_word("+", add, NULL, 0);
@@ -1725,6 +6520,14 @@ void init(void) {
   add_word("BEGIN", begin, NULL, IMMEDIATE);
   add_word("WHILE", while_word, NULL, IMMEDIATE);
   add_word("REPEAT", repeat, NULL, IMMEDIATE);
+  add_word("DO", do_word, NULL, IMMEDIATE);
+  add_word("?DO", qdo_word, NULL, IMMEDIATE);
+  add_word("LOOP", loop_word, NULL, IMMEDIATE);
+  add_word("+LOOP", plus_loop_word, NULL, IMMEDIATE);
+  add_word("LEAVE", leave_word, NULL, IMMEDIATE);
+  add_word("I", i_word, NULL, 0);
+  add_word("J", j_word, NULL, 0);
+  add_word("UNLOOP", unloop_word, NULL, 0);
   add_word("EXIT", exit_word, NULL, 0);
   add_word("INCLUDE", include_forth_file, NULL, IMMEDIATE);
   add_word("@", at_ptr, NULL, 0);
@@ -1738,7 +6541,17 @@ void init(void) {
   add_word("HERE", here_data, NULL, 0);
   add_word("BLOB-HERE", bytes_space_word, NULL, 0);
   add_word("BLOB-LEN", bytes_p_word, NULL, 0);
+  add_word("BLOB-MARK", blob_mark_word, NULL, 0);
+  add_word("BLOB-RELEASE", blob_release_word, NULL, 0);
+  add_word("s\"", s_quote_word, NULL, IMMEDIATE);
   add_word("ALLOC", alloc_data, NULL, 0);
+  add_word("ALLOCATE", allocate_word, NULL, 0);
+  add_word("FREE", free_word, NULL, 0);
+  add_word("RESIZE", resize_word, NULL, 0);
+  add_word("ARENA-NEW", arena_new_word, NULL, 0);
+  add_word("ARENA-ALLOC", arena_alloc_word, NULL, 0);
+  add_word("ARENA-RESET", arena_reset_word, NULL, 0);
+  add_word("ARENA-FREE", arena_free_word, NULL, 0);
   add_word("COPY-CELLS", memcpy_cells, NULL, 0);
   add_word("COPY-BYTES", memcpy_bytes, NULL, 0);
   add_word("TYPE", type, NULL, 0);
@@ -1750,6 +6563,8 @@ void init(void) {
   add_word("PARSE-STRING", parse_string_word, NULL, 0);
   add_word("HERE-CODE", here_code_word, NULL, 0);
   add_word("ALLOC-CODE", alloc_code_word, NULL, 0);
+  add_word("MARKER", marker_word, NULL, 0);
+  add_word("FORGET", forget_word, NULL, 0);
   add_word(",", comma, NULL, 0);
   add_word("INTERPRET-TOKEN", interpret_token_word, NULL, 0);
   add_word("IMMEDIATE", immediate, NULL, IMMEDIATE);
@@ -1758,11 +6573,435 @@ void init(void) {
   add_word("bye", bye, NULL, 0);
 
   add_word("INTERPRET-LINE", interpret_line_c_word, NULL, 0);
+  add_word("SAVE-IMAGE", save_image_word, NULL, 0);
+  add_word("NATIVE-ON", native_on_word, NULL, 0);
+  add_word("NATIVE-OFF", native_off_word, NULL, 0);
+  add_word("COMPILE-C", compile_c_word, NULL, 0);
+
+  resolve_internal_words();
+}
+
+void resolve_internal_words(void) {
+  word_lit = find_word("LIT", 3);
+  word_zbranch = find_word("0BRANCH", 7);
+  word_branch = find_word("BRANCH", 6);
+  word_parse_name = find_word("PARSE-NAME", 10);
+  word_type = find_word("TYPE", 4);
+  word_shell_cmd = find_word("SHELL-CMD", 9);
+  word_lit_add = find_word("(LIT+)", 6);
+  word_dup_fetch = find_word("(DUP@)", 6);
+  word_over_add = find_word("(OVER+)", 7);
+  word_zeq_branch = find_word("(0=0BRANCH)", 11);
+  word_tail = find_word("(TAIL)", 6);
+  word_exit = find_word("EXIT", 4);
+  word_do = find_word("(DO)", 4);
+  word_qdo = find_word("(?DO)", 5);
+  word_loop = find_word("(LOOP)", 6);
+  word_plus_loop = find_word("(+LOOP)", 7);
+  word_leave = find_word("(LEAVE)", 7);
+}
+
+struct prim_op_entry {
+  void (*code)(WORD *);
+  OPCODE op;
+};
+
+// primitives with an inline body in the threaded inner interpreter.
+// add_word() tags a word with its opcode by looking up its code pointer here
+struct prim_op_entry prim_ops[] = {
+    {lit, OP_LIT},
+    {zero_branch, OP_ZBRANCH},
+    {branch, OP_BRANCH},
+    {exit_word, OP_EXIT},
+    {push_val_code, OP_PUSHVAL},
+    {push_ptr_code, OP_PUSHPTR},
+    {add, OP_ADD},
+    {substract, OP_SUB},
+    {multiply, OP_MUL},
+    {minusone, OP_DEC},
+    {dup_word, OP_DUP},
+    {drop, OP_DROP},
+    {swap, OP_SWAP},
+    {over, OP_OVER},
+    {rot, OP_ROT},
+    {equals_zero, OP_EQZ},
+    {equals, OP_EQ},
+    {lessthan, OP_LT},
+    {morethan, OP_GT},
+    {at_ptr, OP_FETCH},
+    {write_ptr, OP_STORE},
+    {to_r, OP_TOR},
+    {from_r, OP_FROMR},
+    {lit_add, OP_LITADD},
+    {dup_fetch, OP_DUPFETCH},
+    {over_add, OP_OVERADD},
+    {zero_equals_branch, OP_ZEQBRANCH},
+    {tail_call, OP_TAIL},
+    {do_runtime, OP_DO},
+    {qdo_runtime, OP_QDO},
+    {loop_runtime, OP_LOOP},
+    {plus_loop_runtime, OP_PLUSLOOP},
+    {leave_runtime, OP_LEAVE},
+    {i_word, OP_I},
+};
+
+u64 primitive_op(void (*code)(WORD *)) {
+  for (u64 x = 0; x < sizeof(prim_ops) / sizeof(prim_ops[0]); x += 1)
+    if (prim_ops[x].code == code)
+      return prim_ops[x].op;
+  return OP_CALL;
 }
 
+#if DIRECT_THREADED
+// Threaded inner interpreter.
+//
+// ip lives in a local (lip) while we run and every word jumps straight to the
+// body of its opcode through a table of label addresses (GCC labels-as-values).
+// Core primitives run inline; when their fast path would hit an error (stack
+// too small or full) they fall back to op_call so the C primitive reports it
+// exactly as before.
+//
+// Each execute() owns the return stack above the rsp it was entered with, so
+// a nested execute() (INCLUDE, LOAD, ...) returns when its own word is done.
+void execute(WORD *w) {
+  static void *dispatch[OP_COUNT] = {
+      [OP_CALL] = &&op_call,
+      [OP_DOCOL] = &&op_docol,
+      [OP_LIT] = &&op_lit,
+      [OP_ZBRANCH] = &&op_zbranch,
+      [OP_BRANCH] = &&op_branch,
+      [OP_EXIT] = &&op_exit,
+      [OP_PUSHVAL] = &&op_pushval,
+      [OP_PUSHPTR] = &&op_pushptr,
+      [OP_ADD] = &&op_add,
+      [OP_SUB] = &&op_sub,
+      [OP_MUL] = &&op_mul,
+      [OP_DEC] = &&op_dec,
+      [OP_DUP] = &&op_dup,
+      [OP_DROP] = &&op_drop,
+      [OP_SWAP] = &&op_swap,
+      [OP_OVER] = &&op_over,
+      [OP_ROT] = &&op_rot,
+      [OP_EQZ] = &&op_eqz,
+      [OP_EQ] = &&op_eq,
+      [OP_LT] = &&op_lt,
+      [OP_GT] = &&op_gt,
+      [OP_FETCH] = &&op_fetch,
+      [OP_STORE] = &&op_store,
+      [OP_TOR] = &&op_tor,
+      [OP_FROMR] = &&op_fromr,
+      [OP_LITADD] = &&op_litadd,
+      [OP_DUPFETCH] = &&op_dupfetch,
+      [OP_OVERADD] = &&op_overadd,
+      [OP_ZEQBRANCH] = &&op_zeqbranch,
+      [OP_TAIL] = &&op_tail,
+      [OP_DO] = &&op_do,
+      [OP_QDO] = &&op_qdo,
+      [OP_LOOP] = &&op_loop,
+      [OP_PLUSLOOP] = &&op_plusloop,
+      [OP_LEAVE] = &&op_leave,
+      [OP_I] = &&op_i,
+  };
+  u64 *saved_ip = ip;
+  u64 rbase = rsp;
+  u64 *lip;
+  WORD *cw;
+  u64 t;
+  u64 tos; // stack[sp - 1] while we run
+  u64 d;   // sp while we run
+
+  if (profiling) {
+    execute_profiled(w);
+    return;
+  }
+  running_word = w;
+  // primitive
+  if (!w->continuation) {
+    if (w->code)
+      w->code(w);
+    ip = saved_ip;
+    return;
+  }
+  lip = w->continuation;
+
+// the top of stack and the depth live in locals (registers) while words run
+// inline and are written back to stack[]/sp only around C primitives. With
+// an empty stack tos is the slack cell below stack[0]
+#define SPILL() (stack[d - 1] = tos, sp = d)
+#define RELOAD() (d = sp, tos = stack[d - 1])
+#define PUSH(v) (stack[d - 1] = tos, d++, tos = (v))
+#define DROP() (d--, tos = stack[d - 1])
+
+  RELOAD();
+
+#define NEXT                                                                   \
+  do {                                                                         \
+    cw = (WORD *)*lip++;                                                       \
+    if (!cw)                                                                   \
+      goto op_exit;                                                            \
+    goto *dispatch[cw->op];                                                    \
+  } while (0)
+
+  NEXT;
+
+op_call:
+  SPILL();
+  ip = lip;
+  running_word = cw;
+  if (cw->code)
+    cw->code(cw);
+  RELOAD();
+  if (cw->continuation && ip == lip)
+    goto op_docol;
+  lip = ip;
+  if (!lip)
+    goto done;
+  NEXT;
+op_docol:
+  if (CHECKED(rsp >= STACK_SIZE)) {
+    printf("%s[ERROR] Return stack overflow calling %s\n%s", SETREDCOLOR,
+           cw->name, RESETALLSTYLES);
+    print_source_line();
+    rsp = rbase;
+    goto done;
+  }
+  running_word = cw;
+  rstack[rsp++] = (u64)lip;
+  lip = cw->continuation;
+  NEXT;
+op_exit:
+  if (rsp <= rbase)
+    goto done;
+  lip = (u64 *)rstack[--rsp];
+  NEXT;
+op_lit:
+  if (CHECKED(d >= STACK_SIZE))
+    goto op_call;
+  PUSH(*lip++);
+  NEXT;
+op_zbranch:
+  if (CHECKED(d == 0))
+    goto op_call;
+  t = tos;
+  DROP();
+  if (t == 0)
+    lip = (u64 *)*lip;
+  else
+    lip++;
+  NEXT;
+op_branch:
+  lip = (u64 *)*lip;
+  NEXT;
+op_pushval:
+  if (CHECKED(d >= STACK_SIZE))
+    goto op_call;
+  PUSH(*cw->data);
+  NEXT;
+op_pushptr:
+  if (CHECKED(d >= STACK_SIZE))
+    goto op_call;
+  PUSH((u64)cw->data);
+  NEXT;
+op_add:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos += stack[d - 2];
+  d--;
+  NEXT;
+op_sub:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos = stack[d - 2] - tos;
+  d--;
+  NEXT;
+op_mul:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos *= stack[d - 2];
+  d--;
+  NEXT;
+op_dec:
+  if (CHECKED(d == 0))
+    goto op_call;
+  tos -= 1;
+  NEXT;
+op_dup:
+  if (CHECKED(d == 0 || d >= STACK_SIZE))
+    goto op_call;
+  PUSH(tos);
+  NEXT;
+op_drop:
+  if (CHECKED(d == 0))
+    goto op_call;
+  DROP();
+  NEXT;
+op_swap:
+  if (CHECKED(d < 2))
+    goto op_call;
+  t = stack[d - 2];
+  stack[d - 2] = tos;
+  tos = t;
+  NEXT;
+op_over:
+  if (CHECKED(d < 2 || d >= STACK_SIZE))
+    goto op_call;
+  t = stack[d - 2];
+  PUSH(t);
+  NEXT;
+op_rot:
+  // ( a b c -- c a b )
+  if (CHECKED(d < 3))
+    goto op_call;
+  t = stack[d - 2];
+  stack[d - 2] = stack[d - 3];
+  stack[d - 3] = tos;
+  tos = t;
+  NEXT;
+op_eqz:
+  if (CHECKED(d == 0))
+    goto op_call;
+  tos = tos == 0;
+  NEXT;
+op_eq:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos = stack[d - 2] == tos;
+  d--;
+  NEXT;
+op_lt:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos = stack[d - 2] < tos;
+  d--;
+  NEXT;
+op_gt:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos = stack[d - 2] > tos;
+  d--;
+  NEXT;
+op_fetch:
+  if (CHECKED(d == 0))
+    goto op_call;
+  tos = *(u64 *)tos;
+  NEXT;
+op_store:
+  if (CHECKED(d < 2) || !tos)
+    goto op_call;
+  *(u64 *)tos = stack[d - 2];
+  d -= 2;
+  tos = stack[d - 1];
+  NEXT;
+op_tor:
+  if (CHECKED(d == 0 || rsp >= STACK_SIZE))
+    goto op_call;
+  rstack[rsp++] = tos;
+  DROP();
+  NEXT;
+op_fromr:
+  if (CHECKED(rsp == 0 || d >= STACK_SIZE))
+    goto op_call;
+  PUSH(rstack[--rsp]);
+  NEXT;
+op_litadd:
+  if (CHECKED(d == 0))
+    goto op_call;
+  tos += *lip++;
+  NEXT;
+op_dupfetch:
+  if (CHECKED(d == 0 || d >= STACK_SIZE))
+    goto op_call;
+  PUSH(*(u64 *)tos);
+  NEXT;
+op_overadd:
+  if (CHECKED(d < 2))
+    goto op_call;
+  tos += stack[d - 2];
+  NEXT;
+op_zeqbranch:
+  if (CHECKED(d == 0))
+    goto op_call;
+  t = tos;
+  DROP();
+  if (t != 0)
+    lip = (u64 *)*lip;
+  else
+    lip++;
+  NEXT;
+op_tail:
+  lip = ((WORD *)*lip)->continuation;
+  NEXT;
+op_do:
+  if (CHECKED(d < 2 || rsp + 2 > STACK_SIZE))
+    goto op_call;
+  rstack[rsp++] = stack[d - 2];
+  rstack[rsp++] = tos;
+  d -= 2;
+  tos = stack[d - 1];
+  NEXT;
+op_qdo:
+  if (CHECKED(d < 2 || rsp + 2 > STACK_SIZE))
+    goto op_call;
+  if (stack[d - 2] == tos) {
+    lip = (u64 *)*lip;
+  } else {
+    rstack[rsp++] = stack[d - 2];
+    rstack[rsp++] = tos;
+    lip++;
+  }
+  d -= 2;
+  tos = stack[d - 1];
+  NEXT;
+op_loop:
+  if (CHECKED(rsp < 2))
+    goto op_call;
+  if (++rstack[rsp - 1] != rstack[rsp - 2]) {
+    lip = (u64 *)*lip;
+  } else {
+    rsp -= 2;
+    lip++;
+  }
+  NEXT;
+op_plusloop:
+  if (CHECKED(d == 0 || rsp < 2))
+    goto op_call;
+  t = tos;
+  DROP();
+  if (loop_step(t))
+    lip = (u64 *)*lip;
+  else
+    lip++;
+  NEXT;
+op_leave:
+  if (CHECKED(rsp < 2))
+    goto op_call;
+  rsp -= 2;
+  lip = (u64 *)*lip;
+  NEXT;
+op_i:
+  if (CHECKED(rsp < 2 || d >= STACK_SIZE))
+    goto op_call;
+  PUSH(rstack[rsp - 1]);
+  NEXT;
+
+done:
+  SPILL();
+  ip = saved_ip;
+#undef NEXT
+#undef SPILL
+#undef RELOAD
+#undef PUSH
+#undef DROP
+}
+#else
 void execute(WORD *w) {
   u64 *saved_ip = ip;
 
+  if (profiling) {
+    execute_profiled(w);
+    return;
+  }
+  running_word = w;
   if (w->code)
     w->code(w);
 
@@ -1772,10 +7011,11 @@ void execute(WORD *w) {
     return;
   }
 
-  // colon word
-  if (ip == saved_ip) {
-    if (ip)
-      rstack[rsp++] = (u64)ip;
+  // colon word. A NULL return address ends this call, so one called from C
+  // (a native word, say) runs its own body only, not the rest of its caller
+  int nested = ip == saved_ip;
+  if (nested) {
+    rstack[rsp++] = 0;
     ip = w->continuation;
   }
 
@@ -1793,6 +7033,7 @@ void execute(WORD *w) {
 
     u64 *saved_ip2 = ip;
 
+    running_word = cw;
     if (cw->code)
       cw->code(cw);
 
@@ -1802,7 +7043,10 @@ void execute(WORD *w) {
       ip = cw->continuation;
     }
   }
+  if (nested)
+    ip = saved_ip;
 }
+#endif
 
 void main_interpret_line(char *line) {
   current_line_buffer = line;
@@ -1812,6 +7056,109 @@ void main_interpret_line(char *line) {
   interpret_line_c_word(NULL);
 }
 
+// Stack guard pages
+//
+// stack, rstack and cfstack each get a PROT_NONE page on both sides. A
+// fault inside one of them is reported as an overflow/underflow of that
+// stack, the stacks are reset and we longjmp back to the REPL. The return
+// and control flow stacks start right above their lower guard. The data
+// stack ends right below its upper guard instead, so an unchecked push past
+// STACK_SIZE faults at once; its underflows are caught by the check in
+// interpret_line_c_word.
+typedef struct guarded {
+  const char *name;
+  unsigned char *base; // lower guard page
+  u64 len;             // whole mapping, guards included
+} GUARDED;
+
+GUARDED guarded[3];
+u64 guarded_count = 0;
+sigjmp_buf repl_jmp;
+int repl_jmp_set = 0;
+char fault_stack[1 << 16];
+
+// returns the first usable byte, or MAP_FAILED. With at_end the bytes end
+// at the upper guard page, otherwise they start at the lower one
+void *map_guarded(const char *name, u64 bytes, int at_end) {
+  u64 page = (u64)sysconf(_SC_PAGESIZE);
+  u64 len = page_round(bytes) + 2 * page;
+  unsigned char *base = mmap(NULL, len, PROT_NONE,
+                             MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (base == MAP_FAILED)
+    return MAP_FAILED;
+  if (mprotect(base + page, len - 2 * page, PROT_READ | PROT_WRITE) == -1) {
+    munmap(base, len);
+    return MAP_FAILED;
+  }
+  guarded[guarded_count].name = name;
+  guarded[guarded_count].base = base;
+  guarded[guarded_count].len = len;
+  guarded_count++;
+  return base + page + (at_end ? page_round(bytes) - bytes : 0);
+}
+
+void unmap_guarded(void) {
+  for (u64 x = 0; x < guarded_count; x += 1)
+    munmap(guarded[x].base, guarded[x].len);
+  guarded_count = 0;
+}
+
+// drop everything a fault or an underflow left half done
+void reset_after_fault(void) {
+  sp = 0;
+  rsp = 0;
+  cfsp = 0;
+  leave_chain = NULL;
+  loop_depth = 0;
+  block_recording = NULL;
+  profile_unwind();
+  ip = NULL;
+  f_mode = INTERPRET;
+  current_def = NULL;
+}
+
+void stack_fault(int sig, siginfo_t *si, void *uctx) {
+  UNUSED(uctx);
+  unsigned char *addr = si->si_addr;
+  u64 page = (u64)sysconf(_SC_PAGESIZE);
+
+  for (u64 x = 0; x < guarded_count; x += 1) {
+    GUARDED *g = &guarded[x];
+    if (addr < g->base || addr >= g->base + g->len)
+      continue;
+    const char *what = addr < g->base + page ? "underflow" : "overflow";
+    printf("%s[ERROR] %s %s in %s\n%s", SETREDCOLOR, g->name, what,
+           running_word ? running_word->name : "<none>", RESETALLSTYLES);
+    if (!repl_jmp_set)
+      _exit(EXIT_FAILURE);
+    siglongjmp(repl_jmp, 1);
+  }
+
+  // not one of ours, crash as usual
+  signal(sig, SIG_DFL);
+}
+
+void stack_error(const char *what) {
+  printf("%s[ERROR] Stack %s in %s\n%s", SETREDCOLOR, what,
+         running_word ? running_word->name : "<none>", RESETALLSTYLES);
+  if (repl_jmp_set)
+    siglongjmp(repl_jmp, 1);
+  reset_after_fault();
+}
+
+void install_stack_fault_handler(void) {
+  stack_t ss = {.ss_sp = fault_stack, .ss_size = sizeof(fault_stack)};
+  sigaltstack(&ss, NULL);
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = stack_fault;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGSEGV, &sa, NULL);
+  sigaction(SIGBUS, &sa, NULL);
+}
+
 void init_config_file(char *home) {
   char configpath[256];
   snprintf(configpath, sizeof(configpath), "%s/.config/skforth", home);
@@ -1856,7 +7203,8 @@ void init_config_file(char *home) {
           "256         ( CF_STACK -- This is for the control flow stack ) \n"
           "1024        ( DATA_SIZE ) \n"
           "1024 64 *   ( MAX_BLOB_SPACE -- Used for string allocation and "
-          "ICL's instructions)");
+          "ICL's instructions)\n"
+          "8           ( NUM_BUFFERS -- in-memory BLOCK buffers )");
     }
     fclose(config);
     break;
@@ -1916,7 +7264,8 @@ void init_config_file(char *home) {
             "256         ( CF_STACK -- This is for the control flow stack ) \n"
             "1024        ( DATA_SIZE ) \n"
             "1024 64 *   ( MAX_BLOB_SPACE -- Used for string allocation and "
-            "ICL's instructions)");
+            "ICL's instructions)\n"
+            "8           ( NUM_BUFFERS -- in-memory BLOCK buffers )");
       }
       fclose(config);
 
@@ -1932,8 +7281,20 @@ void init_config_file(char *home) {
   }
 }
 
-int main(void) {
+int main(int argc, char **argv) {
   char line[256];
+  char *image_path = NULL;
+  int warm = 0;
+
+  for (int x = 1; x < argc; x += 1) {
+    if (strcmp(argv[x], "--image") == 0 && x + 1 < argc) {
+      image_path = argv[++x];
+    } else {
+      fprintf(stderr, "usage: %s [--image <file>]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
   char *home = getenv("HOME");
   if (home == NULL) {
     fprintf(stderr, "%sError: HOME environment variable not found.%s\n",
@@ -1941,8 +7302,22 @@ int main(void) {
     exit(EXIT_FAILURE);
   }
 
+  init_config_file(home);
+
+  // warm start: settings and dictionary come from a saved image
+  if (image_path) {
+    printf("%sLoading image %s...%s", SETGREENCOLOR, image_path,
+           RESETALLSTYLES);
+    warm = load_image(image_path);
+    if (warm)
+      printf("%sDONE\n\n%s", SETGREENCOLOR, RESETALLSTYLES);
+    else
+      printf("%s[WARNING] Falling back to a cold start\n%s", SETYELLOWCOLOR,
+             RESETALLSTYLES);
+  }
+
   // init memory settings from config file
-  {
+  if (!warm) {
     u64 config_stack[CONFIG_STACK_SIZE];
     WORD config_dic[CONFIG_DIC_SIZE];
     stack = config_stack;
@@ -1953,8 +7328,6 @@ int main(void) {
     add_word("INTERPRET-TOKEN", interpret_token_word, NULL, 0);
     add_word("*", multiply, NULL, 0);
 
-    init_config_file(home);
-
     snprintf(line, sizeof(line), "%s/.config/skforth/config.fs", home);
 
     FILE *f_config = fopen(line, "r");
@@ -1978,6 +7351,8 @@ int main(void) {
           SETREDCOLOR, SETYELLOWCOLOR, RESETALLSTYLES);
       exit(EXIT_FAILURE);
     }
+    if (sp > 8)
+      NUM_BUFFERS = spop();
     MAX_BYTES_SPACE = spop();
     DATA_SIZE = spop();
     CF_STACK = spop();
@@ -1989,8 +7364,8 @@ int main(void) {
   }
   // set virtual memory with mmap with desired sizes
 
-  stack = mmap(NULL, STACK_SIZE * CELLSIZE, PROT_READ | PROT_WRITE,
-               MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+  // one slack cell below stack[0] for the native backend
+  stack = map_guarded("Stack", (STACK_SIZE + 1) * CELLSIZE, 1);
 
   if (stack == MAP_FAILED) {
     printf("%s[ERROR] MMAP failed to reserve %llu CELLS in virtual memory for "
@@ -1998,50 +7373,10 @@ int main(void) {
            SETREDCOLOR, (u64)STACK_SIZE, strerror(errno), RESETALLSTYLES);
     exit(EXIT_FAILURE);
   }
+  stack++;
   sp = 0;
 
-  bytes_space = mmap(NULL, MAX_BYTES_SPACE * sizeof(char),
-                     PROT_READ | PROT_WRITE | PROT_EXEC,
-                     MAP_ANONYMOUS | MAP_SHARED, -1, 0);
-  if (bytes_space == MAP_FAILED) {
-    printf("%s[ERROR] MMAP failed to reserve %llu BYTES in "
-           "virtual memory for "
-           "the bytes space\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, ((u64)MAX_WORDS * sizeof(WORD)), strerror(errno),
-           RESETALLSTYLES);
-    exit(EXIT_FAILURE);
-  }
-  bytes_p = 0;
-
-  dictionary = mmap(NULL, MAX_WORDS * sizeof(WORD), PROT_READ | PROT_WRITE,
-                    MAP_ANONYMOUS | MAP_SHARED, -1, 0);
-  if (dictionary == MAP_FAILED) {
-    printf("%s[ERROR] MMAP failed to reserve %llu CELLS (%llu WORDS) in "
-           "virtual memory for "
-           "the dictionary\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, ((u64)MAX_WORDS * sizeof(WORD)), (u64)MAX_WORDS,
-           strerror(errno), RESETALLSTYLES);
-    exit(EXIT_FAILURE);
-  }
-  here = 0;
-
-  current_def = NULL;
-  last_created = NULL;
-
-  code_space =
-      mmap(NULL, MAX_CODE_SPACE * CELLSIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
-           MAP_ANONYMOUS | MAP_SHARED, -1, 0);
-  if (code_space == MAP_FAILED) {
-    printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
-           "virtual memory for "
-           "the code_space\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, MAX_CODE_SPACE, strerror(errno), RESETALLSTYLES);
-    exit(EXIT_FAILURE);
-  }
-  code_idx = 0;
-
-  rstack = mmap(NULL, STACK_SIZE * CELLSIZE, PROT_READ | PROT_WRITE,
-                MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+  rstack = map_guarded("Return stack", STACK_SIZE * CELLSIZE, 0);
   if (rstack == MAP_FAILED) {
     printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
            "virtual memory for "
@@ -2051,8 +7386,7 @@ int main(void) {
   }
   rsp = 0;
 
-  cfstack = mmap(NULL, CF_STACK * sizeof(u64 *), PROT_READ | PROT_WRITE,
-                 MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+  cfstack = map_guarded("Control flow stack", CF_STACK * sizeof(u64 *), 0);
   if (cfstack == MAP_FAILED) {
     printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
            "virtual memory for "
@@ -2062,14 +7396,73 @@ int main(void) {
   }
   cfsp = 0;
 
-  data_space = mmap(NULL, DATA_SIZE * CELLSIZE, PROT_READ | PROT_WRITE,
-                    MAP_ANONYMOUS | MAP_SHARED, -1, 0);
-  if (data_space == MAP_FAILED) {
-    printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
-           "virtual memory for "
-           "data space\n[SYS MSG] %s%s\n",
-           SETREDCOLOR, (u64)DATA_SIZE, strerror(errno), RESETALLSTYLES);
-    exit(EXIT_FAILURE);
+  install_stack_fault_handler();
+  jit_init();
+
+  if (!warm) {
+    bytes_space = reserve_space(0, MAX_BYTES_SPACE * sizeof(char),
+                                PROT_READ | PROT_WRITE,
+                                &bytes_reserve);
+    if (bytes_space == MAP_FAILED) {
+      printf("%s[ERROR] MMAP failed to reserve %llu BYTES in "
+             "virtual memory for "
+             "the bytes space\n[SYS MSG] %s%s\n",
+             SETREDCOLOR, ((u64)MAX_WORDS * sizeof(WORD)), strerror(errno),
+             RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
+    bytes_p = 0;
+
+    dictionary = mmap(NULL, MAX_WORDS * sizeof(WORD), PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    if (dictionary == MAP_FAILED) {
+      printf("%s[ERROR] MMAP failed to reserve %llu CELLS (%llu WORDS) in "
+             "virtual memory for "
+             "the dictionary\n[SYS MSG] %s%s\n",
+             SETREDCOLOR, ((u64)MAX_WORDS * sizeof(WORD)), (u64)MAX_WORDS,
+             strerror(errno), RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
+    here = 0;
+
+    dict_index_size = 1;
+    while (dict_index_size < MAX_WORDS * 2)
+      dict_index_size <<= 1;
+    dict_index = mmap(NULL, dict_index_size * CELLSIZE, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    if (dict_index == MAP_FAILED) {
+      printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
+             "virtual memory for "
+             "the dictionary index\n[SYS MSG] %s%s\n",
+             SETREDCOLOR, dict_index_size, strerror(errno), RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
+    dict_marks_init();
+
+    current_def = NULL;
+    last_created = NULL;
+
+    code_space = reserve_space(0, MAX_CODE_SPACE * CELLSIZE,
+                               PROT_READ | PROT_WRITE,
+                               &code_reserve);
+    if (code_space == MAP_FAILED) {
+      printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
+             "virtual memory for "
+             "the code_space\n[SYS MSG] %s%s\n",
+             SETREDCOLOR, MAX_CODE_SPACE, strerror(errno), RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
+    code_idx = 0;
+
+    data_space = reserve_space(0, DATA_SIZE * CELLSIZE, PROT_READ | PROT_WRITE,
+                               &data_reserve);
+    if (data_space == MAP_FAILED) {
+      printf("%s[ERROR] MMAP failed to reserve %llu CELLS in "
+             "virtual memory for "
+             "data space\n[SYS MSG] %s%s\n",
+             SETREDCOLOR, (u64)DATA_SIZE, strerror(errno), RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
   }
 
   // BLOCKS
@@ -2077,25 +7470,59 @@ int main(void) {
   char block_path[256];
   snprintf(block_path, sizeof(block_path), "%s/.config/skforth/BLOCKS.blk",
            home);
-  int block_fd = open(block_path, O_RDWR);
+  snprintf(block_index_path, sizeof(block_index_path),
+           "%s/.config/skforth/BLOCKS.idx", home);
+  block_fd = open(block_path, O_RDWR);
 
   if (block_fd == -1) {
     printf("%sBLOCKS.blk not found\n%s", SETREDCOLOR, RESETALLSTYLES);
   } else {
-    if (ftruncate(block_fd, BLOCK_SIZE * NUM_BLOCKS) == -1) {
+    // keep blocks added by MORE-BLOCKS in earlier sessions
+    struct stat st = {0};
+    if (fstat(block_fd, &st) == 0 && (u64)st.st_size / BLOCK_SIZE > NUM_BLOCKS)
+      NUM_BLOCKS = (u64)st.st_size / BLOCK_SIZE;
+
+    block_reserve = BLOCK_RESERVE;
+    if (block_reserve < NUM_BLOCKS * BLOCK_SIZE)
+      block_reserve = NUM_BLOCKS * BLOCK_SIZE;
+
+    if ((u64)st.st_size < BLOCK_SIZE * NUM_BLOCKS &&
+        ftruncate(block_fd, BLOCK_SIZE * NUM_BLOCKS) == -1) {
       printf("%s[ERROR] Failed to truncate BLOCKS.blk%s\n", SETREDCOLOR,
              RESETALLSTYLES);
     } else {
-      blocks_base = mmap(NULL, BLOCK_SIZE * NUM_BLOCKS, PROT_READ | PROT_WRITE,
-                         MAP_SHARED, block_fd, 0);
+      blocks_base = mmap(NULL, block_reserve, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (blocks_base != MAP_FAILED)
+        blocks_base = mmap(blocks_base, BLOCK_SIZE * NUM_BLOCKS,
+                           PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                           block_fd, 0);
 
       if (blocks_base == MAP_FAILED) {
         printf("%s[ERROR] MMAP failed to reserve %llu BLOCKS in "
                "virtual memory.\n[SYS MSG] %s%s\n",
                SETREDCOLOR, (u64)NUM_BLOCKS, strerror(errno), RESETALLSTYLES);
+        blocks_base = NULL;
         goto skipblocks;
       }
 
+      if (NUM_BUFFERS == 0)
+        NUM_BUFFERS = 1;
+      // one spare byte: INTERPRET-BLOCK NUL terminates one past the end
+      block_buffer_space =
+          mmap(NULL, NUM_BUFFERS * BLOCK_SIZE + 1, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      block_buffers = malloc(NUM_BUFFERS * sizeof(BLOCK_BUFFER));
+      flush_order = malloc(NUM_BUFFERS * sizeof(BLOCK_BUFFER *));
+      flush_ranges = malloc(NUM_BUFFERS * sizeof(FLUSH_RANGE));
+      if (block_buffer_space == MAP_FAILED || !block_buffers || !flush_order ||
+          !flush_ranges) {
+        printf("%s[ERROR] Could not allocate %llu BLOCK buffers%s\n",
+               SETREDCOLOR, NUM_BUFFERS, RESETALLSTYLES);
+        exit(EXIT_FAILURE);
+      }
+      empty_buffers();
+
       memset(block_path, 0, sizeof(block_path)); // reuse the buffer
       printf("%sCreating a temporary block editor file... \n%s", SETGREENCOLOR,
              RESETALLSTYLES);
@@ -2116,23 +7543,26 @@ int main(void) {
   }
 skipblocks:
 
-  // setup words
-  init();
+  if (!warm) {
+    // setup words
+    init();
+    dict_fence = here;
 
-  memset(line, 0, sizeof(line));
-  // load bootstrap file
-  FILE *f = fopen("bootstrap.fs", "r");
-  if (!f) {
-    printf("%sbootstrap.fs not found\n%s", SETREDCOLOR, RESETALLSTYLES);
-    exit(EXIT_FAILURE);
-  }
-  printf("%sLoading bootstrap.fs...\n%s", SETGREENCOLOR, RESETALLSTYLES);
-  while (fgets(line, sizeof(line), f)) {
-    main_interpret_line(line);
+    memset(line, 0, sizeof(line));
+    // load bootstrap file
+    FILE *f = fopen("bootstrap.fs", "r");
+    if (!f) {
+      printf("%sbootstrap.fs not found\n%s", SETREDCOLOR, RESETALLSTYLES);
+      exit(EXIT_FAILURE);
+    }
+    printf("%sLoading bootstrap.fs...\n%s", SETGREENCOLOR, RESETALLSTYLES);
+    while (fgets(line, sizeof(line), f)) {
+      main_interpret_line(line);
+    }
+    fclose(f);
+    printf("%s$HOME/.config/skforth/config.fs DONE\n\n%s", SETGREENCOLOR,
+           RESETALLSTYLES);
   }
-  fclose(f);
-  printf("%s$HOME/.config/skforth/config.fs DONE\n\n%s", SETGREENCOLOR,
-         RESETALLSTYLES);
 
   memset(line, 0, sizeof(line));
 
@@ -2140,24 +7570,37 @@ skipblocks:
   fflush(stdout);
   printf("%sWelcome to skforth :D \n%s", SETGREENCOLOR, RESETALLSTYLES);
   printf("%sskforth> %s", SETGREENCOLOR, RESETALLSTYLES);
+  if (sigsetjmp(repl_jmp, 1)) {
+    reset_after_fault();
+    printf("%sskforth> %s", SETGREENCOLOR, RESETALLSTYLES);
+  }
+  repl_jmp_set = 1;
   while (fgets(line, sizeof(line), stdin)) {
     main_interpret_line(line);
     printf("%sskforth> %s", SETGREENCOLOR, RESETALLSTYLES);
   }
 
+  save_buffers_at_exit();
+  wait_flush_at_exit();
   if (block_fd != -1) {
     close(block_fd);
-    munmap(blocks_base, BLOCK_SIZE * NUM_BLOCKS);
+    if (blocks_base)
+      munmap(blocks_base, block_reserve);
+    if (block_buffers) {
+      munmap(block_buffer_space, NUM_BUFFERS * BLOCK_SIZE + 1);
+      free(block_buffers);
+      free(flush_order);
+      free(flush_ranges);
+    }
     close(tmp_block_editor_fd);
   }
 
-  munmap(bytes_space, MAX_BYTES_SPACE);
-  munmap(stack, STACK_SIZE * CELLSIZE);
+  munmap(bytes_space, bytes_reserve);
   munmap(dictionary, MAX_WORDS * sizeof(WORD));
-  munmap(code_space, MAX_CODE_SPACE * CELLSIZE);
-  munmap(rstack, STACK_SIZE * CELLSIZE);
-  munmap(cfstack, CF_STACK * sizeof(u64 *));
-  munmap(data_space, DATA_SIZE * CELLSIZE);
+  munmap(dict_index, dict_index_size * CELLSIZE);
+  munmap(code_space, code_reserve);
+  unmap_guarded();
+  munmap(data_space, data_reserve);
 
   return 0;
 }